@@ -0,0 +1,167 @@
+#include "orderbook/orderbook_manager.h"
+#include "orderbook/orderbook_manager_view.h"
+#include "orderbook/utils.h"
+
+#include "price_computation/demand_oracle.h"
+#include "price_computation/demand_worker_pool.h"
+
+#include "speedex/speedex_static_configs.h"
+
+#include "utils/numa_topology.h"
+#include "utils/price.h"
+#include <utils/time.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace speedex;
+
+using utils::init_time_measurement;
+using utils::measure_time;
+
+constexpr static unsigned int NUM_SHARES = 16;
+
+void make_orderbooks(OrderbookManager& manager, uint16_t num_assets, size_t offers_per_book) {
+	std::minstd_rand gen(0);
+	std::uniform_int_distribution<uint64_t> amount_dist(1, 1'000'000);
+	std::uniform_real_distribution<double> price_dist(0.1, 10);
+
+	int x = 0;
+	uint64_t offer_id = 0;
+
+	ProcessingSerialManager serial_manager(manager);
+
+	for (size_t idx = 0; idx < manager.get_num_orderbooks(); idx++) {
+		auto category = category_from_idx(idx, num_assets);
+		for (size_t i = 0; i < offers_per_book; i++) {
+			Offer offer;
+			offer.category = category;
+			offer.offerId = offer_id++;
+			offer.owner = 1;
+			offer.amount = amount_dist(gen);
+			offer.minPrice = price::from_double(price_dist(gen));
+
+			serial_manager.add_offer(idx, offer, x, x);
+		}
+	}
+	serial_manager.finish_merge();
+}
+
+//! Average time (seconds) of one demand query, with every price
+//! changing between queries (so no cached results are reused).
+float run_queries(OrderbookManager& manager, bool numa_aware, size_t num_queries) {
+	auto& work_units = manager.get_orderbooks();
+	uint16_t num_assets = manager.get_num_assets();
+
+	DemandWorkerPool pool(NUM_DEMAND_POOL_THREADS, -1, numa_aware);
+	ParallelDemandOracle<NUM_SHARES> oracle(work_units.size(), num_assets, pool);
+
+	oracle.activate_oracle(work_units, manager.get_numa_node_bounds());
+
+	std::minstd_rand gen(1);
+	std::uniform_real_distribution<double> price_dist(0.5, 2);
+	std::vector<Price> prices(num_assets);
+	std::vector<uint128_t> supplies(num_assets), demands(num_assets);
+
+	auto timestamp = init_time_measurement();
+	for (size_t q = 0; q < num_queries; q++) {
+		for (auto& p : prices) {
+			p = price::from_double(price_dist(gen));
+		}
+		std::fill(supplies.begin(), supplies.end(), 0);
+		std::fill(demands.begin(), demands.end(), 0);
+		oracle.get_supply_demand(prices.data(), supplies.data(), demands.data(), work_units, 10);
+	}
+	float res = measure_time(timestamp);
+
+	oracle.deactivate_oracle();
+	return res / num_queries;
+}
+
+enum class Placement {
+	//! First touch by unpinned threads.
+	DEFAULT,
+	//! Every page interleaved across nodes, unpinned threads.
+	INTERLEAVED,
+	//! Orderbooks and demand threads placed by node.
+	NODE_LOCAL
+};
+
+const char* placement_name(Placement placement) {
+	switch(placement) {
+		case Placement::DEFAULT:
+			return "default placement";
+		case Placement::INTERLEAVED:
+			return "interleaved placement";
+		case Placement::NODE_LOCAL:
+			return "node-local placement";
+	}
+	throw std::runtime_error("invalid placement");
+}
+
+void run_benchmark(Placement placement, uint16_t num_assets, size_t offers_per_book, size_t num_queries) {
+	// before any threads exist, so that every thread inherits the policy
+	if (placement == Placement::INTERLEAVED 
+		&& !NumaTopology::interleave_current_thread_memory()) {
+		std::printf("failed to set interleaved memory policy\n");
+	}
+
+	const bool numa_aware = (placement == Placement::NODE_LOCAL);
+
+	OrderbookManager manager(num_assets);
+	manager.set_numa_placement(numa_aware);
+	make_orderbooks(manager, num_assets, offers_per_book);
+
+	auto timestamp = init_time_measurement();
+	manager.commit_for_production(1);
+	float commit_time = measure_time(timestamp);
+
+	float query_time = run_queries(manager, numa_aware, num_queries);
+
+	std::printf("%s: commit %f s, demand query %f ms\n",
+		placement_name(placement),
+		commit_time,
+		query_time * 1000);
+	std::fflush(stdout);
+}
+
+int main(int argc, char const *argv[])
+{
+	if (argc != 4) {
+		std::printf("usage: ./numa_demand_benchmark <num_assets> <offers_per_orderbook> <num_queries>\n");
+		return 1;
+	}
+
+	uint16_t num_assets = std::stoi(argv[1]);
+	size_t offers_per_book = std::stoi(argv[2]);
+	size_t num_queries = std::stoi(argv[3]);
+
+	std::printf("numa nodes: %lu demand pool threads: %u\n",
+		NumaTopology::get().num_nodes(), NUM_DEMAND_POOL_THREADS);
+	std::fflush(stdout);
+
+	// Memory policies are per thread (and inherited), so each
+	// placement runs in a fresh process.
+	for (auto placement : {Placement::DEFAULT, Placement::INTERLEAVED, Placement::NODE_LOCAL}) {
+		pid_t pid = fork();
+		if (pid < 0) {
+			throw std::runtime_error("fork failed");
+		}
+		if (pid == 0) {
+			run_benchmark(placement, num_assets, offers_per_book, num_queries);
+			std::exit(0);
+		}
+		int status;
+		waitpid(pid, &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			std::printf("%s: benchmark failed\n", placement_name(placement));
+		}
+	}
+}
@@ -232,6 +232,11 @@ public:
 	size_t size() {
 		return modification_log.size();
 	}
+
+	//! The log that this log's entries are merged into.
+	AccountModificationLog& get_main_log() {
+		return main_log;
+	}
 };
 
 } /* speedex */
@@ -0,0 +1,129 @@
+/**
+ * SPEEDEX: A Scalable, Parallelizable, and Economically Efficient Decentralized Exchange
+ * Copyright (C) 2023 Geoffrey Ramseyer
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/*! \file cancel_claims.h
+
+Offers claimed by cancellations while producing a block.
+
+Cancellations in block production do not mark offers in the orderbook's
+trie.  They check that the offer exists, and claim its key here (so that
+only one cancellation gets the offer).  Undoing a cancellation releases
+the claim.  When the block's transactions are done, the orderbook
+marks all claimed offers for deletion in one pass, in key order,
+from a single thread.  If the block is abandoned instead (the
+orderbooks are rolled back), its claims are dropped.
+
+Claims are split over independently locked shards (by the low byte of
+the offerId), so concurrent cancellations on one orderbook rarely wait
+on the same lock.  Each shard is a sorted vector (a shard holds few
+keys, so inserting costs less than allocating a tree node), which
+claim() searches to reject a second claim on one key.
+*/
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "orderbook/typedefs.h"
+
+namespace speedex {
+
+class OfferCancelClaims {
+
+	using prefix_t = OrderbookTriePrefix;
+
+	constexpr static size_t NUM_SHARDS = 16;
+
+	struct alignas(64) Shard {
+		std::mutex mtx;
+		//! Sorted.
+		std::vector<prefix_t> keys;
+	};
+
+	std::array<Shard, NUM_SHARDS> shards;
+
+	//! Keys end with the offerId (big endian).
+	Shard& get_shard(const prefix_t& key) {
+		auto bytes = key.template get_bytes_array<std::array<uint8_t, ORDERBOOK_KEY_LEN>>();
+		return shards[bytes[ORDERBOOK_KEY_LEN - 1] % NUM_SHARDS];
+	}
+
+public:
+
+	OfferCancelClaims() : shards() {}
+
+	OfferCancelClaims(const OfferCancelClaims&) = delete;
+	OfferCancelClaims(OfferCancelClaims&&) = delete;
+
+	//! Claim \a key.  Returns false if it is already claimed.
+	bool claim(const prefix_t& key) {
+		auto& shard = get_shard(key);
+		std::lock_guard lock(shard.mtx);
+		auto it = std::lower_bound(shard.keys.begin(), shard.keys.end(), key);
+		if (it != shard.keys.end() && !(key < *it)) {
+			return false;
+		}
+		shard.keys.insert(it, key);
+		return true;
+	}
+
+	//! Release a claim on \a key (no-op if \a key is not claimed).
+	void release(const prefix_t& key) {
+		auto& shard = get_shard(key);
+		std::lock_guard lock(shard.mtx);
+		auto it = std::lower_bound(shard.keys.begin(), shard.keys.end(), key);
+		if (it != shard.keys.end() && !(key < *it)) {
+			shard.keys.erase(it);
+		}
+	}
+
+	//! Drop all claims.  Not threadsafe with claim() or release().
+	void clear() {
+		for (auto& shard : shards) {
+			shard.keys.clear();
+		}
+	}
+
+	//! Remove all claims, returning the claimed keys in sorted order.
+	//! Not threadsafe with claim() or release().
+	std::vector<prefix_t> extract_sorted() {
+		std::vector<prefix_t> out;
+		for (auto& shard : shards) {
+			out.insert(out.end(), shard.keys.begin(), shard.keys.end());
+			shard.keys.clear();
+		}
+		std::sort(out.begin(), out.end());
+		return out;
+	}
+
+	//! Number of claimed keys.  Not threadsafe with claim() or release().
+	size_t size() const {
+		size_t out = 0;
+		for (auto const& shard : shards) {
+			out += shard.keys.size();
+		}
+		return out;
+	}
+};
+
+} /* speedex */
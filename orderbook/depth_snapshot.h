@@ -0,0 +1,132 @@
+/**
+ * SPEEDEX: A Scalable, Parallelizable, and Economically Efficient Decentralized Exchange
+ * Copyright (C) 2023 Geoffrey Ramseyer
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/*! \file depth_snapshot.h
+
+Read-only copy of an orderbook's price index, for market data queries.
+
+Each orderbook publishes a new snapshot when it builds its price index
+in block production, and readers hold the snapshot through a shared_ptr,
+so queries never touch the live tries or index (and so can run
+concurrently with block processing).
+
+The copy shares the index's blocks (which the live index duplicates
+before modifying), so publishing a snapshot does not copy every
+price level.
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+
+#include "orderbook/helpers.h"
+#include "orderbook/price_index.h"
+
+#include "xdr/types.h"
+
+namespace speedex {
+
+class OrderbookDepthSnapshot {
+
+	uint64_t block_number;
+
+	OrderbookPriceIndex index;
+
+	void check_level(size_t idx) const {
+		if (idx >= num_price_levels()) {
+			throw std::out_of_range("invalid depth snapshot level");
+		}
+	}
+
+public:
+
+	//! Copy a finalized index.
+	OrderbookDepthSnapshot(const OrderbookPriceIndex& index, uint64_t block_number)
+		: block_number(block_number)
+		, index(index) {}
+
+	//! Block whose committed offers this snapshot reflects
+	//! (before that block's clearing).
+	uint64_t get_block_number() const {
+		return block_number;
+	}
+
+	//! Number of distinct price levels.
+	size_t num_price_levels() const {
+		return index.size() - 1;
+	}
+
+	//! Price of level \a idx (in increasing order).
+	Price level_price(size_t idx) const {
+		check_level(idx);
+		return index.key(idx + 1);
+	}
+
+	//! Cumulative metadata up to and including level \a idx.
+	EndowAccumulator level_cumulative(size_t idx) const {
+		check_level(idx);
+		return index.metadata(idx + 1);
+	}
+
+	//! Total endowment (and endowment times price) of offers with
+	//! minPrice at most \a p.
+	EndowAccumulator depth_at(Price p) const {
+		return index.lookup(p);
+	}
+
+	//! Total endowment of offers with minPrice at most \a p.
+	int64_t endow_at(Price p) const {
+		return depth_at(p).endow;
+	}
+
+	//! Total endowment of all offers.
+	int64_t total_endow() const {
+		return index.metadata(index.size() - 1).endow;
+	}
+};
+
+//! Latest published snapshot of one orderbook.  Readers and the
+//! publishing thread swap the pointer under a mutex.
+class DepthSnapshotSlot {
+
+	mutable std::mutex mtx;
+	std::shared_ptr<const OrderbookDepthSnapshot> snapshot;
+
+public:
+
+	void publish(std::shared_ptr<const OrderbookDepthSnapshot> new_snapshot) {
+		{
+			std::lock_guard lock(mtx);
+			snapshot.swap(new_snapshot);
+		}
+		// the previous snapshot (if this was the last reference)
+		// is freed here, outside the lock.
+	}
+
+	//! nullptr if none published yet.
+	std::shared_ptr<const OrderbookDepthSnapshot> get() const {
+		std::lock_guard lock(mtx);
+		return snapshot;
+	}
+};
+
+} /* speedex */
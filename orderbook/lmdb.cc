@@ -26,6 +26,7 @@
 #include "speedex/speedex_static_configs.h"
 
 #include <cinttypes>
+#include <filesystem>
 #include <set>
 
 namespace speedex
@@ -279,10 +280,13 @@ OrderbookLMDB::write_thunks(const uint64_t current_block_number,
                         }
                     }
 
-                    if (keys_that_will_be_later_deleted.find(offer_key_buf)
-                        != keys_that_will_be_later_deleted.end())
+                    if (db_put
+                        && keys_that_will_be_later_deleted.find(offer_key_buf)
+                               != keys_that_will_be_later_deleted.end())
                     {
-                        db_put = false;
+                        // Deleted by a later thunk (e.g. cancelled).
+                        // Offers below it may still need to be written.
+                        continue;
                     }
 
                     if (db_put)
@@ -506,6 +510,114 @@ OrderbookLMDB::write_thunks(const uint64_t current_block_number,
     return garbage;
 }
 
+namespace detail
+{
+
+void
+AsyncOrderbookLMDBShardWorker::add_task(std::function<void()> fn)
+{
+    wait_for_async_task();
+    std::lock_guard lock(mtx);
+    task = std::move(fn);
+    error = nullptr;
+    cv.notify_all();
+}
+
+std::exception_ptr
+AsyncOrderbookLMDBShardWorker::wait_for_task()
+{
+    wait_for_async_task();
+    std::lock_guard lock(mtx);
+    return error;
+}
+
+void
+AsyncOrderbookLMDBShardWorker::run()
+{
+    while (true)
+    {
+        std::unique_lock lock(mtx);
+
+        if ((!done_flag) && (!task))
+        {
+            cv.wait(lock, [this]() { return done_flag || task; });
+        }
+
+        if (done_flag)
+            return;
+
+        // Run the task without holding mtx, so that other threads
+        // taking mtx (e.g. to wait on cv) do not block for the
+        // whole task.
+        auto current_task = std::move(task);
+        task = nullptr;
+        task_running = true;
+        lock.unlock();
+
+        std::exception_ptr task_error;
+        try
+        {
+            current_task();
+        } catch (...)
+        {
+            task_error = std::current_exception();
+        }
+        current_task = nullptr;
+
+        lock.lock();
+        error = task_error;
+        task_running = false;
+        cv.notify_all();
+    }
+}
+
+} // namespace detail
+
+void
+OrderbookManagerLMDB::check_env_layout()
+{
+    auto has_data = [](std::string const& dir) {
+        return std::filesystem::exists(dir + "data.mdb");
+    };
+
+    std::string root
+        = std::string(ROOT_DB_DIRECTORY) + std::string(OFFER_DB);
+
+    if (has_data(root))
+    {
+        throw std::runtime_error(
+            "orderbook lmdb at " + root
+            + " uses the unsharded layout; it must be rebuilt"
+              " (shards now live in " + root + "<shard>/)");
+    }
+
+    // A different shard count assigns orderbooks to different shards.
+    if (has_data(get_lmdb_env_name(NUM_ORDERBOOK_DB_SHARDS)))
+    {
+        throw std::runtime_error(
+            "orderbook lmdb at " + root + " has more than "
+            + std::to_string(NUM_ORDERBOOK_DB_SHARDS)
+            + " shards (NUM_ORDERBOOK_DB_SHARDS changed)");
+    }
+
+    size_t num_with_data = 0;
+    for (size_t i = 0; i < NUM_ORDERBOOK_DB_SHARDS; i++)
+    {
+        if (has_data(get_lmdb_env_name(i)))
+        {
+            num_with_data++;
+        }
+    }
+    if (num_with_data != 0 && num_with_data != NUM_ORDERBOOK_DB_SHARDS)
+    {
+        throw std::runtime_error(
+            "orderbook lmdb at " + root + " has data in only "
+            + std::to_string(num_with_data) + " of "
+            + std::to_string(NUM_ORDERBOOK_DB_SHARDS)
+            + " shards (NUM_ORDERBOOK_DB_SHARDS changed)");
+    }
+}
+
 OrderbookLMDB::OrderbookLMDB(OfferCategory const& category,
                              OrderbookManagerLMDB& manager_lmdb)
     : SharedLMDBInstance(manager_lmdb.get_base_instance(category))
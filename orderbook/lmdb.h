@@ -24,8 +24,11 @@ LMDB instance and related methods for persisting orderbook data.
 */
 
 #include <cstdint>
+#include <exception>
+#include <functional>
 #include <memory>
 #include <mutex>
+#include <string>
 #include <vector>
 
 #include "config.h"
@@ -35,8 +38,12 @@ LMDB instance and related methods for persisting orderbook data.
 #include "orderbook/thunk.h"
 #include "orderbook/typedefs.h"
 
+#include "speedex/speedex_static_configs.h"
+
 #include "utils/background_deleter.h"
 
+#include <utils/async_worker.h>
+
 
 namespace speedex {
 
@@ -49,56 +56,132 @@ left inside the class when going out of scope, which should cut down
 on accidental memory leaks.
 */
 
-class OrderbookManagerLMDB {
+namespace detail {
+
+/*! Runs the persistence of one orderbook lmdb shard in a background thread.
+
+An lmdb write transaction cannot move between threads, so each shard
+keeps one worker (and so one thread) for its whole lifetime.
+*/
+class AsyncOrderbookLMDBShardWorker : public utils::AsyncWorker {
+
+	//! Next task, not yet started.
+	std::function<void()> task;
+	//! The background thread is running a task (without holding mtx).
+	bool task_running;
+	std::exception_ptr error;
+
+	bool exists_work_to_do() override final {
+		return static_cast<bool>(task) || task_running;
+	}
+
+	void run();
+
+public:
+	AsyncOrderbookLMDBShardWorker()
+		: utils::AsyncWorker()
+		, task()
+		, task_running(false)
+		, error()
+	{
+		start_async_thread([this] {run();});
+	}
+
+	AsyncOrderbookLMDBShardWorker(const AsyncOrderbookLMDBShardWorker&) = delete;
+	AsyncOrderbookLMDBShardWorker(AsyncOrderbookLMDBShardWorker&&) = delete;
+
+	//! Run \a fn in the background thread (after any previous task).
+	void add_task(std::function<void()> fn);
 
-	//External iface is set up so that we could introduce limited sharding here
-	lmdb::BaseLMDBInstance base_instance;
+	//! Wait for the current task to finish.
+	//! Returns the exception it threw, if any.
+	std::exception_ptr wait_for_task();
 
-	const size_t num_orderbooks;
+	//! Background thread is signaled to terminate when object leaves scope.
+	~AsyncOrderbookLMDBShardWorker() {
+		terminate_worker();
+	}
+};
+
+} /* detail */
+
+/*! The lmdb environments storing orderbooks.
+
+Orderbooks are sharded across NUM_ORDERBOOK_DB_SHARDS environments
+(by sell asset), so that each shard is persisted in its own write
+transaction, in parallel with the others.
+
+Shard i lives in OFFER_DB/<i>/.  Data directories written with a
+different layout (the old single environment directly in OFFER_DB/,
+or a different shard count) are not migrated; opening them throws.
+*/
+class OrderbookManagerLMDB {
 
-	std::string get_lmdb_env_name() {
+	std::vector<std::unique_ptr<lmdb::BaseLMDBInstance>> base_instances;
+
+	static std::string get_lmdb_env_name(size_t shard) {
 		return std::string(ROOT_DB_DIRECTORY) 
-		+ std::string(OFFER_DB);
+		+ std::string(OFFER_DB)
+		+ std::to_string(shard) + "/";
 	}
 
+	//! Throws if the existing data directory does not match
+	//! the shard layout of this build.
+	static void check_env_layout();
+
 public:
 
-	/*! Initialize lmdb with mapsize of 2^40 (somewhat arbitrary choice)
+	/*! Initialize each shard with mapsize of 2^40 (somewhat arbitrary choice)
 	*/
 	OrderbookManagerLMDB(size_t num_orderbooks)
-		: base_instance{0x100'0000'0000, num_orderbooks + 1}
-		, num_orderbooks(num_orderbooks)
-		{}
+		: base_instances()
+		{
+			for (size_t i = 0; i < NUM_ORDERBOOK_DB_SHARDS; i++) {
+				base_instances.push_back(
+					std::make_unique<lmdb::BaseLMDBInstance>(
+						0x100'0000'0000, num_orderbooks + 1));
+			}
+		}
 
-	lmdb::BaseLMDBInstance& get_base_instance(OfferCategory const& category) {
-		return base_instance;
+	//! Shard storing the orderbook of \a category.
+	//! Depends only on the category, so that adding assets
+	//! does not move orderbooks between shards.
+	static size_t get_shard(OfferCategory const& category) {
+		return category.sellAsset % NUM_ORDERBOOK_DB_SHARDS;
 	}
 
-	size_t get_num_base_instances() {
-		return 1;
+	lmdb::BaseLMDBInstance& get_base_instance(OfferCategory const& category) {
+		return *base_instances[get_shard(category)];
 	}
 
-	std::pair<size_t, size_t> get_base_instance_range(size_t instance_number) {
-		return {0, num_orderbooks};
+	size_t get_num_base_instances() const {
+		return base_instances.size();
 	}
 
 	lmdb::BaseLMDBInstance& get_base_instance_by_index(size_t idx) {
-		return base_instance;
+		return *base_instances.at(idx);
 	}
 
 	void open_lmdb_env() {
-		auto name = get_lmdb_env_name();
-		base_instance.open_env(name.c_str());
+		check_env_layout();
+		for (size_t i = 0; i < base_instances.size(); i++) {
+			auto name = get_lmdb_env_name(i);
+			base_instances[i]->open_env(name.c_str());
+		}
 	}
 
 	void create_db()
 	{
-		base_instance.create_metadata_db();
+		for (auto& instance : base_instances) {
+			instance->create_metadata_db();
+		}
 	}
 
 	void open_db()
 	{
-		base_instance.open_metadata_db();
+		for (auto& instance : base_instances) {
+			instance->open_metadata_db();
+		}
 	}
 };
 
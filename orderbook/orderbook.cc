@@ -36,9 +36,17 @@
 
 #include <utils/serialize_endian.h>
 
+#include <atomic>
 #include <cinttypes>
+#include <cmath>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <vector>
 
+#include <tbb/enumerable_thread_specific.h>
 #include <tbb/task_arena.h>
+#include <tbb/task_group.h>
 
 namespace speedex {
 
@@ -93,9 +101,119 @@ class CompleteClearingFunc
     }
 };
 
+using ThreadLocalModificationLogs = tbb::enumerable_thread_specific<
+    std::unique_ptr<SerialAccountModificationLog>>;
+
+//! Lambda which fully clears offers, and can be applied to different
+//! offers concurrently (e.g. via parallel_apply).  Account
+//! modifications go to the calling thread's serial log, which is
+//! set up once per thread (not once per offer).
+//! Once clearing any offer fails, the remaining calls (of this
+//! and of any copies) do nothing.
+template<typename DB>
+class ParallelCompleteClearingFunc
+{
+    const Price sellPrice;
+    const Price buyPrice;
+    const uint8_t tax_rate;
+    DB& db;
+    ThreadLocalModificationLogs& local_logs;
+    std::atomic<bool>& aborted;
+
+  public:
+    ParallelCompleteClearingFunc(Price sellPrice,
+                                 Price buyPrice,
+                                 uint8_t tax_rate,
+                                 DB& db,
+                                 ThreadLocalModificationLogs& local_logs,
+                                 std::atomic<bool>& aborted)
+        : sellPrice(sellPrice)
+        , buyPrice(buyPrice)
+        , tax_rate(tax_rate)
+        , db(db)
+        , local_logs(local_logs)
+        , aborted(aborted)
+    {}
+
+    void operator()(const Offer& offer)
+    {
+        if (aborted.load(std::memory_order_relaxed)) {
+            return;
+        }
+        auto& local_log = *local_logs.local();
+        try {
+            CompleteClearingFunc<DB>(
+                sellPrice, buyPrice, tax_rate, db, local_log)(offer);
+        } catch (...) {
+            aborted.store(true, std::memory_order_relaxed);
+            throw;
+        }
+    }
+};
+
+//! Fully clear every offer in \a offers.  Tries with at least
+//! \a parallel_threshold offers are split over subtries and
+//! cleared in parallel, so that one large orderbook does not bound
+//! the clearing time of a block.
+//! Throws if any offer cannot be cleared.
+template<typename DB>
+static void
+clear_offers_full(OrderbookTrie& offers,
+                  Price sellPrice,
+                  Price buyPrice,
+                  uint8_t tax_rate,
+                  DB& db,
+                  SerialAccountModificationLog& serial_account_log,
+                  size_t parallel_threshold)
+{
+    if (offers.size() < parallel_threshold) {
+        CompleteClearingFunc<DB> func(
+            sellPrice, buyPrice, tax_rate, db, serial_account_log);
+        offers.apply(func);
+        return;
+    }
+    auto& main_log = serial_account_log.get_main_log();
+    ThreadLocalModificationLogs local_logs([&main_log]() {
+        return std::make_unique<SerialAccountModificationLog>(main_log);
+    });
+    std::atomic<bool> aborted = false;
+    ParallelCompleteClearingFunc<DB> func(
+        sellPrice, buyPrice, tax_rate, db, local_logs, aborted);
+    tbb::this_task_arena::isolate(
+        [&func, &offers]() { offers.parallel_apply(func); });
+}
+
+std::optional<Offer>
+Orderbook::claim_for_deletion(const prefix_t key)
+{
+    // committed_offers is not modified while transactions are
+    // processed, so this lookup does not race with other claims.
+    auto value = committed_offers.get_value(key);
+    if (!value) {
+        return std::nullopt;
+    }
+    if (!cancel_claims->claim(key)) {
+        return std::nullopt;
+    }
+    return Offer(*value);
+}
+
+void
+Orderbook::mark_claimed_for_deletion()
+{
+    for (auto const& key : cancel_claims->extract_sorted()) {
+        if (!committed_offers.mark_for_deletion(key)) {
+            throw std::runtime_error("claimed offer missing from orderbook");
+        }
+    }
+}
+
 void
 Orderbook::tentative_commit_for_validation(uint64_t current_block_number)
 {
+    // Empty except when producing a block.
+    mark_claimed_for_deletion();
+
     {
         auto lock = lmdb_instance.lock();
         // std::lock_guard lock(*lmdb_instance.mtx);
@@ -103,7 +221,27 @@ Orderbook::tentative_commit_for_validation(uint64_t current_block_number)
         thunk.uncommitted_offers_vec
             = uncommitted_offers.accumulate_values<std::vector<Offer>>();
         auto& accumulate_deleted_keys = thunk.deleted_keys;
+        size_t prev_deleted_count = accumulate_deleted_keys.deleted_keys.size();
         committed_offers.perform_marked_deletions(accumulate_deleted_keys);
+
+        for (auto const& offer : thunk.uncommitted_offers_vec) {
+            index_changes.log_offer_change(offer.minPrice, offer.amount);
+        }
+        auto const& deleted = accumulate_deleted_keys.deleted_keys;
+        for (size_t i = prev_deleted_count; i < deleted.size(); i++) {
+            index_changes.log_offer_change(deleted[i].second.minPrice,
+                                           -deleted[i].second.amount);
+        }
+        if (thunk.uncommitted_offers_vec.size() > 0
+            || deleted.size() > prev_deleted_count) {
+            invalidate_hash();
+        }
+    }
+
+    // Past this point, patching the index costs about as much as
+    // rebuilding it (and this bounds the log's size when validating).
+    if (index_changes.size() > num_price_levels()) {
+        index_changes.invalidate();
     }
     committed_offers.merge_in(std::move(uncommitted_offers));
     uncommitted_offers.clear();
@@ -113,6 +251,8 @@ void
 Orderbook::undo_thunk(OrderbookLMDBCommitmentThunk& thunk)
 {
     std::printf("starting thunk undo\n");
+    index_changes.invalidate();
+    invalidate_hash();
     for (auto& kv : thunk.deleted_keys.deleted_keys) {
         committed_offers.insert(kv.first, OfferWrapper(kv.second));
     }
@@ -160,6 +300,9 @@ Orderbook::rollback_validation()
 {
 
     uncommitted_offers.clear();
+    clear_deletion_claims();
+    index_changes.invalidate();
+    invalidate_hash();
     committed_offers
         .do_rollback(); // takes care of new round's uncommitted offers, so we
                         // can safely clear them from the thunk.
@@ -180,15 +323,31 @@ Orderbook::commit_for_production(uint64_t current_block_number)
 {
     tentative_commit_for_validation(current_block_number);
     generate_metadata_index();
+    publish_depth_snapshot(current_block_number);
 }
 
 void
 Orderbook::generate_metadata_index()
 {
-    indexed_metadata
+    if (index_changes.is_valid() && price_index.apply_changes(index_changes)) {
+        index_changes.reset();
+        return;
+    }
+
+    auto levels
         = committed_offers
               .metadata_traversal<EndowAccumulator, Price, FuncWrapper>(
                   price::PRICE_BIT_LEN);
+
+    // levels[0] is the traversal's (empty) sentinel entry,
+    // which price_index.clear() recreates.
+    price_index.clear();
+    price_index.reserve(levels.size() - 1);
+    for (size_t i = 1; i < levels.size(); i++) {
+        price_index.append_level(levels[i].key, levels[i].metadata);
+    }
+    price_index.finalize();
+    index_changes.reset();
 }
 
 std::unique_ptr<ThunkGarbage<typename OrderbookTrie::TrieT>> __attribute__((
@@ -231,8 +390,7 @@ double
 Orderbook::max_feasible_smooth_mult_double(int64_t amount,
                                            const Price* prices) const
 {
-    size_t start = 1;
-    size_t end = indexed_metadata.size() - 1;
+    size_t end = price_index.size() - 1;
 
     Price sell_price = prices[category.sellAsset];
     Price buy_price = prices[category.buyAsset];
@@ -243,33 +401,15 @@ Orderbook::max_feasible_smooth_mult_double(int64_t amount,
         return 0;
     }
 
-    if (amount > indexed_metadata[end].metadata.endow) {
+    if (amount > price_index.endow(end)) {
         return 0;
     }
 
-    Price max_activated_price = 0;
-
-    int mp = (end + start) / 2;
-    while (true) {
-        if (end == start) {
-            if (indexed_metadata[end].metadata.endow > amount) {
-                max_activated_price = indexed_metadata[end].key;
-            } else {
-                if (end + 1 == indexed_metadata.size()) {
-                    return 0;
-                }
-                max_activated_price = indexed_metadata[end + 1].key;
-            }
-            break;
-        }
-
-        if (amount >= indexed_metadata[mp].metadata.endow) {
-            start = mp + 1;
-        } else {
-            end = mp;
-        }
-        mp = (start + end) / 2;
+    size_t activated_idx = price_index.first_idx_with_endow_above(amount);
+    if (activated_idx == price_index.size()) {
+        return 0;
     }
+    Price max_activated_price = price_index.key(activated_idx);
 
     Price raw_difference = exact_exchange_rate - max_activated_price;
     if (exact_exchange_rate <= max_activated_price) {
@@ -285,8 +425,7 @@ Orderbook::max_feasible_smooth_mult_double(int64_t amount,
 uint8_t
 Orderbook::max_feasible_smooth_mult(int64_t amount, const Price* prices) const
 {
-    size_t start = 1;
-    size_t end = indexed_metadata.size() - 1;
+    size_t end = price_index.size() - 1;
 
     Price sell_price = prices[category.sellAsset];
     Price buy_price = prices[category.buyAsset];
@@ -297,33 +436,15 @@ Orderbook::max_feasible_smooth_mult(int64_t amount, const Price* prices) const
         return UINT8_MAX;
     }
 
-    if (amount > indexed_metadata[end].metadata.endow) {
+    if (amount > price_index.endow(end)) {
         return UINT8_MAX;
     }
 
-    Price max_activated_price = 0;
-
-    int mp = (end + start) / 2;
-    while (true) {
-        if (end == start) {
-            if (indexed_metadata[end].metadata.endow > amount) {
-                max_activated_price = indexed_metadata[end].key;
-            } else {
-                if (end + 1 == indexed_metadata.size()) {
-                    return UINT8_MAX;
-                }
-                max_activated_price = indexed_metadata[end + 1].key;
-            }
-            break;
-        }
-
-        if (amount >= indexed_metadata[mp].metadata.endow) {
-            start = mp + 1;
-        } else {
-            end = mp;
-        }
-        mp = (start + end) / 2;
+    size_t activated_idx = price_index.first_idx_with_endow_above(amount);
+    if (activated_idx == price_index.size()) {
+        return UINT8_MAX;
     }
+    Price max_activated_price = price_index.key(activated_idx);
 
     Price raw_difference = exact_exchange_rate - max_activated_price;
     if (exact_exchange_rate <= max_activated_price) {
@@ -342,12 +463,36 @@ Orderbook::max_feasible_smooth_mult(int64_t amount, const Price* prices) const
     return 0;
 }
 
+double
+Orderbook::trade_volume_sensitivity(const Price* prices,
+                                    const uint8_t smooth_mult) const
+{
+    auto [full_exec_p, partial_exec_p]
+        = get_execution_prices(prices, smooth_mult);
+
+    auto metadata_partial = get_metadata(partial_exec_p);
+    auto metadata_full = metadata_partial;
+    if (smooth_mult) {
+        metadata_full = get_metadata(full_exec_p);
+    }
+
+    double sell_price = price::to_double(prices[category.sellAsset]);
+
+    // Fully executing offers trade in proportion to the sell price.
+    // Offers in the smoothing band go from not executing to fully
+    // executing as the exchange rate moves by a factor of
+    // 1 - 2^-smooth_mult (about 2^-smooth_mult in log terms).
+    double full_exec_volume = sell_price * metadata_full.endow;
+    double band_volume
+        = sell_price * (metadata_partial.endow - metadata_full.endow);
+    return full_exec_volume + std::ldexp(band_volume, smooth_mult);
+}
+
 std::pair<double, double>
 Orderbook::satisfied_and_lost_utility(int64_t amount, const Price* prices) const
 {
 
-    size_t start = 1;
-    size_t end = indexed_metadata.size() - 1;
+    size_t end = price_index.size() - 1;
 
     Price sell_price = prices[category.sellAsset];
     Price buy_price = prices[category.buyAsset];
@@ -358,42 +503,15 @@ Orderbook::satisfied_and_lost_utility(int64_t amount, const Price* prices) const
         return { 0, 0 };
     }
 
-    if (amount > indexed_metadata[end].metadata.endow) {
+    if (amount > price_index.endow(end)) {
         throw std::runtime_error("invalid clearing amount");
     }
 
     auto max_clearing = get_metadata(exact_exchange_rate);
 
-    size_t realized_idx = 0;
-
     // Price max_activated_price = 0;
 
-    int mp = (end + start) / 2;
-    while (true) {
-        if (end == start) {
-            realized_idx = end;
-            // realized_clearing = indexed_metadata[end].metadata;
-
-            /*	if (indexed_metadata[end].metadata.endow >= amount) {
-                            realized_clearing = indexed_metadata[end].metadata;
-                    } else {
-                            if (end + 1 == indexed_metadata.size()) {
-                                    realized_clearing =
-               indexed_metadata.back().metadata;
-                            }
-                            realized_clearing =
-               indexed_metadata[end+1].metadata;
-                    } */
-            break;
-        }
-
-        if (amount > indexed_metadata[mp].metadata.endow) {
-            start = mp + 1;
-        } else {
-            end = mp;
-        }
-        mp = (start + end) / 2;
-    }
+    size_t realized_idx = price_index.first_idx_with_endow_at_least(amount);
 
     // auto realized_clearing = indexed_metadata[realized_idx].metadata;
 
@@ -408,7 +526,7 @@ Orderbook::satisfied_and_lost_utility(int64_t amount, const Price* prices) const
         throw std::runtime_error("invalid");
     }
 
-    auto fully_realized_clearing = indexed_metadata[realized_idx - 1].metadata;
+    auto fully_realized_clearing = price_index.metadata(realized_idx - 1);
 
     // std::printf("%lu %lu %lf\n", realized_clearing.endow, max_clearing.endow,
     // price::to_double(exact_exchange_rate));
@@ -423,7 +541,7 @@ Orderbook::satisfied_and_lost_utility(int64_t amount, const Price* prices) const
     satisfied_utility
         += (partial_amount * price::to_double(exact_exchange_rate))
            - (partial_amount
-              * price::to_double(indexed_metadata[realized_idx].key));
+              * price::to_double(price_index.key(realized_idx)));
 
     double lost_utility = total_utility - satisfied_utility;
 
@@ -481,38 +599,10 @@ awaiter_t{&(indexed_metadata[mp].key), scheduler};
 EndowAccumulator
 Orderbook::get_metadata(Price p) const
 {
-    int start = 1;
-    int end = indexed_metadata.size() - 1;
-    DEMAND_CALC_INFO("committed_offers_sz:%d", committed_offers.size());
-    DEMAND_CALC_INFO(
-        "indexed_metadata_sz:%d, end:%d", indexed_metadata.size(), end);
-    if (end <= 0) {
-        DEMAND_CALC_INFO("empty work unit, outputting 0");
-        return EndowAccumulator{};
-    }
-    if (p > indexed_metadata[end].key) {
-        DEMAND_CALC_INFO("outputting end");
-        DEMAND_CALC_INFO("%lu, %lu", p, indexed_metadata[end].key);
-        return indexed_metadata[end].metadata;
-    }
-    int mp = (end + start) / 2;
-
-    while (true) {
-        if (end == start) {
-            DEMAND_CALC_INFO("outputting idx %d, key %f",
-                             end,
-                             price::to_double(indexed_metadata[end - 1].key));
-            DEMAND_CALC_INFO("supply:%lu",
-                             indexed_metadata[end - 1].metadata.endow);
-            return indexed_metadata[end - 1].metadata;
-        }
-        if (p >= indexed_metadata[mp].key) {
-            start = mp + 1;
-        } else {
-            end = mp;
-        }
-        mp = (end + start) / 2;
-    }
+    DEMAND_CALC_INFO("committed_offers_sz:%d, index_sz:%d",
+                     committed_offers.size(),
+                     price_index.size());
+    return price_index.lookup_excluding_top_level(p);
 }
 
 std::pair<Price, Price>
@@ -627,39 +717,18 @@ Orderbook::calculate_demands_and_supplies_times_prices_from_metadata(
             "or binary search is broken (or maybe an overflow)");
     }
 
-    uint128_t full_exec_trade_volume = static_cast<uint128_t>(full_exec_endow)
-                                       * static_cast<uint128_t>(sell_price);
-    uint128_t partial_exec_trade_volume = 0;
-
-    auto wide_multiply_safe = [](uint128_t const& endow_times_limit_price,
-                                 uint64_t const& price) -> uint128_t {
-        uint128_t upper = endow_times_limit_price >> 64;
-        uint128_t lower = endow_times_limit_price & UINT64_MAX;
-
-        upper *= price;
-        lower *= price;
-
-        return (upper << (64 - price::PRICE_RADIX))
-               + (lower >> price::PRICE_RADIX);
-    };
-
-    if (smooth_mult > 0) {
-        // REQUIRE: smooth_mult + price::PRICE_BIT_LEN <= 63
-        // e.g. smooth_mult <= 15
-
-        uint128_t part1 = (static_cast<uint128_t>(sell_price)
-                           * static_cast<uint128_t>(partial_exec_endow));
-        uint128_t part2
-            = wide_multiply_safe(partial_exec_endow_times_price, buy_price);
-
-        if (part1 < part2) {
-            throw std::runtime_error("arithmetic error");
-        }
-        partial_exec_trade_volume = (part1 - part2) << smooth_mult;
-    }
-
+    bool arith_error = false;
     uint128_t total_trade_volume
-        = full_exec_trade_volume + partial_exec_trade_volume;
+        = trade_volume_times_prices(sell_price,
+                                    buy_price,
+                                    smooth_mult,
+                                    full_exec_endow,
+                                    partial_exec_endow,
+                                    partial_exec_endow_times_price,
+                                    arith_error);
+    if (arith_error) {
+        throw std::runtime_error("arithmetic error");
+    }
 
     demands_workspace[category.buyAsset] += total_trade_volume;
     supplies_workspace[category.sellAsset] += total_trade_volume;
@@ -867,6 +936,8 @@ Orderbook::tentative_clear_offers_for_validation(
     const OrderbookStateCommitmentChecker& clearing_commitment_log,
     BlockStateUpdateStatsWrapper& state_update_stats)
 {
+    // validation does not use (or maintain) the price index
+    index_changes.invalidate();
 
     prefix_t partialExecThresholdKey(
         local_clearing_log.partialExecThresholdKey);
@@ -879,12 +950,6 @@ Orderbook::tentative_clear_offers_for_validation(
     Price sellPrice = clearing_commitment_log.prices[category.sellAsset];
     Price buyPrice = clearing_commitment_log.prices[category.buyAsset];
 
-    CompleteClearingFunc func(sellPrice,
-                              buyPrice,
-                              clearing_commitment_log.tax_rate,
-                              db,
-                              serial_account_log);
-
     unsigned char zero_buf[ORDERBOOK_KEY_LEN];
     memset(zero_buf, 0, ORDERBOOK_KEY_LEN);
 
@@ -912,8 +977,17 @@ Orderbook::tentative_clear_offers_for_validation(
         validation_statistics.activated_supply
             += FractionalAsset::from_integral(
                 committed_offers.get_root_metadata().endow);
+        if (committed_offers.size() > 0) {
+            invalidate_hash();
+        }
         try {
-            committed_offers.apply(func);
+            clear_offers_full(committed_offers,
+                              sellPrice,
+                              buyPrice,
+                              clearing_commitment_log.tax_rate,
+                              db,
+                              serial_account_log,
+                              parallel_clear_threshold);
         } catch (...) {
             std::printf("failed apply WHEN NO PARTIAL EXEC OFFER in category "
                         "sell %" PRIu32 " buy %" PRIu32
@@ -994,7 +1068,17 @@ Orderbook::tentative_clear_offers_for_validation(
         thunk.cleared_offers
             = committed_offers.endow_split(endow_below_partial_exec_key);
 
-        thunk.cleared_offers.apply(func);
+        if (thunk.cleared_offers.size() > 0 || partial_exec_sell_amount > 0) {
+            invalidate_hash();
+        }
+
+        clear_offers_full(thunk.cleared_offers,
+                          sellPrice,
+                          buyPrice,
+                          clearing_commitment_log.tax_rate,
+                          db,
+                          serial_account_log,
+                          parallel_clear_threshold);
 
         state_update_stats.fully_clear_offer_count
             += thunk.cleared_offers.size();
@@ -1055,20 +1139,21 @@ Orderbook::process_clear_offers(
                               params.supply_activated.value);
 
     auto fully_cleared_trie = committed_offers.endow_split(clear_amount);
+    if (fully_cleared_trie.size() > 0) {
+        invalidate_hash();
+    }
 
     Price sellPrice = prices[category.sellAsset];
     Price buyPrice = prices[category.buyAsset];
 
-    CompleteClearingFunc func(
-        sellPrice, buyPrice, tax_rate, db, serial_account_log);
-
-    /*	tbb::this_task_arena::isolate([&func, &fully_cleared_trie]() {
-                    fully_cleared_trie.parallel_apply(func);
-            });
-    */
-    // todo see if coroutines still don't make sense
     try {
-        fully_cleared_trie.apply(func);
+        clear_offers_full(fully_cleared_trie,
+                          sellPrice,
+                          buyPrice,
+                          tax_rate,
+                          db,
+                          serial_account_log,
+                          parallel_clear_threshold);
     } catch (...) {
         fully_cleared_trie._log("fully cleared trie: ");
 
@@ -1077,9 +1162,11 @@ Orderbook::process_clear_offers(
     }
     state_update_stats.fully_clear_offer_count += fully_cleared_trie.size();
 
+    int64_t fully_cleared_endow = fully_cleared_trie.get_root_metadata().endow;
+
     auto remaining_to_clear = params.supply_activated
                               - FractionalAsset::from_integral(
-                                  fully_cleared_trie.get_root_metadata().endow);
+                                  fully_cleared_endow);
 
     {
         auto lock = lmdb_instance.lock();
@@ -1112,6 +1199,7 @@ Orderbook::process_clear_offers(
         clearing_commitment_log.partialExecThresholdKey.fill(0);
         clearing_commitment_log.thresholdKeyIsNull = 1;
 
+        index_changes.log_clear_all();
         return;
     }
     clearing_commitment_log.thresholdKeyIsNull = 0;
@@ -1160,6 +1248,12 @@ Orderbook::process_clear_offers(
     clearing_commitment_log.partialExecThresholdKey
         = partial_exec_key->template get_bytes_array<xdr::opaque_array<ORDERBOOK_KEY_LEN>>();
 
+    index_changes.log_clearing(partial_exec_offer.minPrice,
+                               fully_cleared_endow + sell_amount);
+    if (sell_amount > 0) {
+        invalidate_hash();
+    }
+
     partial_exec_offer.amount -= sell_amount;
 
     // db.transfer_escrow(idx, category.sellAsset, -sell_amount);
@@ -1188,6 +1282,10 @@ Orderbook::rollback_thunks(uint64_t current_block_number)
         throw std::runtime_error("can't rollback persisted objects");
     }
 
+    // Claims of a block being produced belong to a block after
+    // current_block_number.
+    clear_deletion_claims();
+
     auto& thunks = lmdb_instance.get_thunks_ref();
 
     for (size_t i = 0; i < thunks.size();) {
@@ -1208,30 +1306,83 @@ Orderbook::load_lmdb_contents_to_memory()
     auto rtx = lmdb_instance.rbegin();
     auto cursor = rtx.cursor_open(lmdb_instance.get_data_dbi());
 
-    prefix_t key_buf;
+    // Values point into the lmdb map, and remain valid while rtx is open.
+    // lmdb keys are trie keys, so the cursor visits offers in trie order.
+    //
+    // Each full chunk of consecutive offers is decoded into its own trie
+    // by a separate task, while the cursor moves on.  Chunks cover
+    // disjoint key ranges, so merging them only touches the paths along
+    // chunk boundaries.  The last (partial) chunk, which is all of a
+    // small orderbook, is inserted directly on this thread.
+    std::deque<std::vector<lmdb::dbval>> chunk_values;
+    std::deque<OrderbookTrie> chunks;
+    tbb::task_group chunk_tasks;
+
+    // Queued tasks reference chunk_values and chunks, so every exit
+    // path waits for them before those go out of scope.
+    try {
+        std::vector<lmdb::dbval> values;
+        for (auto kv : cursor) {
+            values.push_back(kv.second);
+            if (values.size() == LOAD_CHUNK_SIZE) {
+                auto& chunk_vals
+                    = chunk_values.emplace_back(std::move(values));
+                auto& chunk = chunks.emplace_back();
+                chunk_tasks.run([&chunk_vals, &chunk]() {
+                    for (auto const& value : chunk_vals) {
+                        load_offer(value, chunk);
+                    }
+                    std::vector<lmdb::dbval>().swap(chunk_vals);
+                });
+                values = std::vector<lmdb::dbval>();
+            }
+        }
 
-    for (auto kv : cursor) {
-        Offer offer;
-        dbval_to_xdr(kv.second, offer);
-        generate_orderbook_trie_key(offer, key_buf);
-        if (offer.amount <= 0) {
-
-            std::printf("offer.owner = %" PRIu64 " offer.amount = %" PRId64
-                        " offer.offerId = %" PRIu64 " sellAsset %" PRIu32
-                        " buyAsset %" PRIu32 "\n",
-                        offer.owner,
-                        offer.amount,
-                        offer.offerId,
-                        offer.category.sellAsset,
-                        offer.category.buyAsset);
-            std::fflush(stdout);
-            throw std::runtime_error(
-                "invalid offer amount present in database!");
+        for (auto const& value : values) {
+            load_offer(value, committed_offers);
         }
-        committed_offers.insert(key_buf, OfferWrapper(offer));
+    } catch (...) {
+        chunk_tasks.cancel();
+        try {
+            chunk_tasks.wait();
+        } catch (...) {
+            // report the first error, not a chunk task's
+        }
+        throw;
+    }
+    chunk_tasks.wait();
+
+    for (auto& chunk : chunks) {
+        committed_offers.merge_in(std::move(chunk));
     }
 
+    index_changes.invalidate();
+    invalidate_hash();
     generate_metadata_index();
 }
 
+void
+Orderbook::load_offer(const lmdb::dbval& value, OrderbookTrie& offers)
+{
+    Offer offer;
+    dbval_to_xdr(value, offer);
+
+    prefix_t key_buf;
+    generate_orderbook_trie_key(offer, key_buf);
+    if (offer.amount <= 0) {
+
+        std::printf("offer.owner = %" PRIu64 " offer.amount = %" PRId64
+                    " offer.offerId = %" PRIu64 " sellAsset %" PRIu32
+                    " buyAsset %" PRIu32 "\n",
+                    offer.owner,
+                    offer.amount,
+                    offer.offerId,
+                    offer.category.sellAsset,
+                    offer.category.buyAsset);
+        std::fflush(stdout);
+        throw std::runtime_error("invalid offer amount present in database!");
+    }
+    offers.insert(key_buf, OfferWrapper(offer));
+}
+
 } // namespace speedex
@@ -25,16 +25,24 @@ Manage a set of offers trading one fixed asset for another fixed asset.
 */
 
 
+#include <bit>
 #include <cstdint>
 #include <iomanip>
+#include <memory>
+#include <optional>
 #include <sstream>
 
 #include <xdrpp/marshal.h>
 
+#include "orderbook/cancel_claims.h"
+#include "orderbook/depth_snapshot.h"
 #include "orderbook/helpers.h"
 #include "orderbook/lmdb.h"
+#include "orderbook/price_index.h"
 #include "orderbook/typedefs.h"
 
+#include "utils/price.h"
+
 namespace speedex {
 
 typedef __int128 int128_t;
@@ -102,14 +110,39 @@ class Orderbook {
 		}
 	};
 
-	using IndexType = trie::IndexedMetadata
-					<
-						EndowAccumulator,
-						Price,
-						FuncWrapper
-					>;
+	//! Cumulative endowments by price level, rebuilt by
+	//! generate_metadata_index().
+	OrderbookPriceIndex price_index;
+
+	//! Changes to committed_offers since price_index was built.
+	PriceIndexChangeLog index_changes;
+
+	//! price_index as of the last commit_for_production().
+	//! Shares the index's blocks (copy-on-write), so publishing
+	//! costs O(number of blocks), not O(number of price levels).
+	//! unique_ptr to keep the orderbook movable.
+	std::unique_ptr<DepthSnapshotSlot> depth_snapshot;
 
-	std::vector<IndexType> indexed_metadata;
+	void publish_depth_snapshot(uint64_t current_block_number) {
+		depth_snapshot->publish(
+			std::make_shared<const OrderbookDepthSnapshot>(
+				price_index, current_block_number));
+	}
+
+	//! Root hash of committed_offers, if they have not changed
+	//! since it was last computed.
+	std::optional<Hash> cached_root_hash;
+
+	void invalidate_hash() {
+		cached_root_hash.reset();
+	}
+
+	//! Clearing (or validating the clearing of) at least this
+	//! many offers at once is split across threads.
+	size_t parallel_clear_threshold;
+
+	//! Offers claimed by cancellations in the block being produced.
+	std::unique_ptr<OfferCancelClaims> cancel_claims;
 
 	uint64_t get_persisted_round_number() const {
 		return lmdb_instance.get_persisted_round_number();
@@ -118,8 +151,17 @@ class Orderbook {
 	void tentative_commit_for_validation(uint64_t current_block_number); //creates thunk (within lmdb instance)
 	void commit_for_production(uint64_t current_block_number); // creates lmdb thunk
 
+	//! Patches price_index with index_changes if possible,
+	//! and otherwise rebuilds it from committed_offers.
 	void generate_metadata_index();
 
+	//! Free the index, so that the next generate_metadata_index()
+	//! allocates it afresh (on the calling thread's NUMA node).
+	void release_metadata_index() {
+		price_index = OrderbookPriceIndex();
+		index_changes.invalidate();
+	}
+
 	void undo_thunk(OrderbookLMDBCommitmentThunk& thunk);
 
 	std::unique_ptr<ThunkGarbage<OrderbookTrie::TrieT>>
@@ -136,6 +178,25 @@ class Orderbook {
 		return committed_offers.unmark_for_deletion(key);
 	}
 
+	//! Cancel an offer in block production: claim it, instead of
+	//! marking it in committed_offers.  Returns nullopt if the offer
+	//! does not exist or is already claimed.
+	std::optional<Offer> claim_for_deletion(const prefix_t key);
+
+	//! Undo claim_for_deletion().
+	void release_deletion_claim(const prefix_t key) {
+		cancel_claims->release(key);
+	}
+
+	//! Mark the claimed offers for deletion, in key order
+	//! (so consecutive marks share most of their trie path).
+	void mark_claimed_for_deletion();
+
+	//! Drop the claims of a block that will not be committed.
+	void clear_deletion_claims() {
+		cancel_claims->clear();
+	}
+
 	friend class OrderbookManager;
 
 	void rollback_validation();
@@ -154,21 +215,37 @@ class Orderbook {
 			 + std::to_string(category.buyAsset); // TODO type
 	}
 
+	//! Offers loaded from lmdb per parallel task.  Smaller
+	//! orderbooks are loaded on the calling thread.
+	constexpr static size_t LOAD_CHUNK_SIZE = 1 << 14;
+
+	//! Decode one offer stored in lmdb, and insert it into \a offers.
+	static void load_offer(const lmdb::dbval& value, OrderbookTrie& offers);
+
 	void load_lmdb_contents_to_memory();
 
 public:
+
+	//! Default parallel_clear_threshold.
+	constexpr static size_t PARALLEL_CLEAR_THRESHOLD = 10000;
+
 	Orderbook(OfferCategory category, OrderbookManagerLMDB& manager_lmdb)
 	: category(category), 
 	  committed_offers(),
 	  uncommitted_offers(),
 	  lmdb_instance(category, manager_lmdb), 
-	  indexed_metadata() {
+	  price_index(),
+	  index_changes(),
+	  depth_snapshot(std::make_unique<DepthSnapshotSlot>()),
+	  cached_root_hash(),
+	  parallel_clear_threshold(PARALLEL_CLEAR_THRESHOLD),
+	  cancel_claims(std::make_unique<OfferCancelClaims>()) {
 	}
 
 //	void clear_() {
 //		uncommitted_offers.clear();
 //		committed_offers.clear();
-//		indexed_metadata.clear();
+//		price_index.clear();
 //		lmdb_instance.clear_();
 //	}
 
@@ -204,7 +281,20 @@ public:
 		lmdb_instance.open_db(name.c_str());
 	}
 
+	//! Most orderbooks do not change in a given block, so the
+	//! root hash is only recomputed after committed_offers change.
 	void hash(Hash& hash_buf) {
+		if (cached_root_hash) {
+			hash_buf = *cached_root_hash;
+			return;
+		}
+		committed_offers.hash(hash_buf);
+		cached_root_hash = hash_buf;
+	}
+
+	//! Recompute the root hash, bypassing (and not updating)
+	//! the cache.  For testing the cache.
+	void hash_uncached(Hash& hash_buf) {
 		committed_offers.hash(hash_buf);
 	}
 
@@ -256,6 +346,45 @@ public:
 		const EndowAccumulator& metadata_partial,
 		const EndowAccumulator& metadata_full);
 
+	//! Trade volume (in units of endowment times price) of one orderbook,
+	//! given the endowment that fully executes and the endowment
+	//! (and endowment times minPrice) that partially executes.
+	//! Does not throw; sets \a arith_error (never clears it) instead,
+	//! so that batched callers can check once per batch.
+	static uint128_t trade_volume_times_prices(
+		const Price sell_price,
+		const Price buy_price,
+		const uint8_t smooth_mult,
+		const uint64_t full_exec_endow,
+		const uint64_t partial_exec_endow,
+		const uint128_t partial_exec_endow_times_price,
+		bool& arith_error)
+	{
+		uint128_t full_exec_trade_volume
+			= static_cast<uint128_t>(full_exec_endow)
+				* static_cast<uint128_t>(sell_price);
+
+		if (smooth_mult == 0) {
+			return full_exec_trade_volume;
+		}
+
+		// REQUIRE: smooth_mult + price::PRICE_BIT_LEN <= 63
+		// e.g. smooth_mult <= 15
+
+		uint128_t part1 = static_cast<uint128_t>(sell_price)
+			* static_cast<uint128_t>(partial_exec_endow);
+
+		// partial_exec_endow_times_price * buy_price, without overflowing
+		uint128_t upper = (partial_exec_endow_times_price >> 64) * buy_price;
+		uint128_t lower = (partial_exec_endow_times_price & UINT64_MAX) * buy_price;
+		uint128_t part2 = (upper << (64 - price::PRICE_RADIX))
+			+ (lower >> price::PRICE_RADIX);
+
+		arith_error |= (part1 < part2);
+
+		return full_exec_trade_volume + ((part1 - part2) << smooth_mult);
+	}
+
 	uint8_t max_feasible_smooth_mult(
 		int64_t amount, const Price* prices) const;
 	double max_feasible_smooth_mult_double(
@@ -264,13 +393,39 @@ public:
 	std::pair<double, double> satisfied_and_lost_utility(
 		int64_t amount, const Price* prices) const;
 
+	//! Estimated derivative of this orderbook's trade volume (in the
+	//! units of calculate_demands_and_supplies_times_prices()) with
+	//! respect to the log of its exchange rate.
+	double trade_volume_sensitivity(
+		const Price* prices, const uint8_t smooth_mult) const;
+
 	size_t num_open_offers() const;
 
+	//! Number of distinct minPrices among committed offers,
+	//! as of the last generate_metadata_index().
+	size_t num_price_levels() const {
+		return price_index.size() - 1;
+	}
+
+	//! Estimated relative cost of one demand query on this orderbook.
+	//! Two price index lookups, each a search over the price levels,
+	//! plus a fixed per-orderbook overhead.
+	size_t estimated_query_cost() const {
+		constexpr size_t BASE_QUERY_COST = 8;
+		return BASE_QUERY_COST + 2 * std::bit_width(num_price_levels());
+	}
+
 	std::pair<uint64_t, uint64_t> get_supply_bounds(
 		const Price* prices, const uint8_t smooth_mult) const;
 	std::pair<uint64_t, uint64_t> get_supply_bounds(
 		Price sell_price, Price buy_price, const uint8_t smooth_mult) const;
 
+	//! Clear offers serially unless there are at least
+	//! \a threshold of them (e.g. SIZE_MAX for always serial).
+	void set_parallel_clear_threshold(size_t threshold) {
+		parallel_clear_threshold = threshold;
+	}
+
 	//! Returns the OfferCategory for this orderbook, which specifies
 	//! the buy and sell assets for this orderbook.
 	OfferCategory get_category() const {
@@ -280,6 +435,12 @@ public:
 	size_t size() const {
 		return committed_offers.size();
 	}
+
+	//! Latest published depth snapshot (nullptr if none yet).
+	//! Safe to call concurrently with block processing.
+	std::shared_ptr<const OrderbookDepthSnapshot> get_depth_snapshot() const {
+		return depth_snapshot->get();
+	}
 };
 
 } /* namespace speedex */
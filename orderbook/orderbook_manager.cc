@@ -28,6 +28,10 @@
 #include "stats/block_update_stats.h"
 
 #include "utils/debug_macros.h"	
+#include "utils/numa_task_arenas.h"
+#include "utils/numa_topology.h"
+
+#include <exception>
 
 namespace speedex {
 
@@ -38,11 +42,20 @@ OrderbookManager::OrderbookManager(
 		: orderbooks()
 		, num_assets(0)
 		, lmdb(get_num_orderbooks_by_asset_count(num_new_assets))
+		, use_numa_placement(NUMA_AWARE_PLACEMENT)
+		, lmdb_shard_orderbooks()
+		, lmdb_shard_workers()
 	{	
+		for (size_t i = 0; i < lmdb.get_num_base_instances(); i++) {
+			lmdb_shard_workers.emplace_back(
+				std::make_unique<detail::AsyncOrderbookLMDBShardWorker>());
+		}
 		increase_num_traded_assets(num_new_assets);
 		num_assets = num_new_assets;
 	}
 
+OrderbookManager::~OrderbookManager() = default;
+
 void OrderbookManager::increase_num_traded_assets(
 	uint16_t new_asset_count) 
 {
@@ -64,6 +77,14 @@ void OrderbookManager::increase_num_traded_assets(
 	}
 	orderbooks = std::move(new_orderbooks);
 	num_assets = new_asset_count;
+	orderbook_numa_nodes.assign(orderbooks.size(), -1);
+
+	lmdb_shard_orderbooks.assign(lmdb.get_num_base_instances(), {});
+	for (size_t i = 0; i < orderbooks.size(); i++) {
+		lmdb_shard_orderbooks[
+			OrderbookManagerLMDB::get_shard(orderbooks[i].get_category())]
+			.push_back(i);
+	}
 }
 
 template<auto func, typename... Args>
@@ -89,20 +110,17 @@ void OrderbookManager::generic_map_serial(Args... args) {
 template<auto func, typename... Args>
 void OrderbookManager::generic_map_loading(uint64_t current_block_number, Args... args) {
 
-	//TODO parallelize loop if this ever is necessary.
-	for (auto i = 0u; i < lmdb.get_num_base_instances(); i++) {
-		auto [start, end] = lmdb.get_base_instance_range(i);
-		auto& local_lmdb = lmdb.get_base_instance_by_index(i);
-		if (local_lmdb.get_persisted_round_number() < current_block_number) {
-			tbb::parallel_for(
-				tbb::blocked_range<size_t>(start, end),
-					[this, current_block_number, &args...] (auto r) {
-						for (unsigned int j = r.begin(); j < r.end(); j++) {
-							(orderbooks[j].*func)(current_block_number, args...);
-						}
-				});
-		}
-	}
+	tbb::parallel_for(
+		tbb::blocked_range<size_t>(0, orderbooks.size()),
+			[this, current_block_number, &args...] (auto r) {
+				for (unsigned int j = r.begin(); j < r.end(); j++) {
+					auto& local_lmdb 
+						= lmdb.get_base_instance(orderbooks[j].get_category());
+					if (local_lmdb.get_persisted_round_number() < current_block_number) {
+						(orderbooks[j].*func)(current_block_number, args...);
+					}
+				}
+		});
 }
 
 void OrderbookManager::commit_for_loading(uint64_t current_block_number) {
@@ -115,31 +133,32 @@ void OrderbookManager::finalize_for_loading(uint64_t current_block_number) {
 		current_block_number);
 }
 
-void OrderbookManager::persist_lmdb_for_loading(uint64_t current_block_number) {
-
-	for (auto i = 0u; i < lmdb.get_num_base_instances(); i++) {
-		auto [start, end] = lmdb.get_base_instance_range(i);
-		auto& local_lmdb = lmdb.get_base_instance_by_index(i);
+template<typename Fn>
+void OrderbookManager::for_each_lmdb_shard(Fn&& fn) {
+	for (size_t shard = 0; shard < lmdb_shard_workers.size(); shard++) {
+		lmdb_shard_workers[shard]->add_task([&fn, shard] {
+			fn(shard);
+		});
+	}
+	std::exception_ptr error;
+	for (auto& worker : lmdb_shard_workers) {
+		auto worker_error = worker->wait_for_task();
+		if (!error) {
+			error = worker_error;
+		}
+	}
+	if (error) {
+		std::rethrow_exception(error);
+	}
+}
 
+void OrderbookManager::persist_lmdb_for_loading(uint64_t current_block_number) {
+	for_each_lmdb_shard([this, current_block_number] (size_t shard) {
+		auto& local_lmdb = lmdb.get_base_instance_by_index(shard);
 		if (local_lmdb.get_persisted_round_number() < current_block_number) {
-
-			ThunkGarbage<OrderbookTrie::TrieT> garbage;
-
-			auto wtx = local_lmdb.wbegin();
-
-			for (auto j = start; j < end; j++) {
-				auto orderbook_garbage 
-					= orderbooks[j].persist_lmdb(current_block_number, wtx);
-				if (orderbook_garbage != nullptr) {
-					garbage.add(orderbook_garbage -> release());
-				}
-			}
-
-			thunk_garbage_deleter.call_delete(garbage.release());
-
-			local_lmdb.commit_wtxn(wtx, current_block_number);
+			persist_lmdb_shard(shard, current_block_number);
 		}
-	}
+	});
 }
 
 void OrderbookManager::create_lmdb() {
@@ -154,7 +173,61 @@ void OrderbookManager::open_lmdb() {
 
 void OrderbookManager::commit_for_production(uint64_t current_block_number) {
 	std::lock_guard lock(mtx);
-	generic_map<&Orderbook::commit_for_production>(current_block_number);
+	if (use_numa_placement && NumaTopology::get().num_nodes() > 1) {
+		numa_commit_for_production(current_block_number);
+		return;
+	}
+
+	numa_node_bounds.clear();
+	tbb::parallel_for(
+		tbb::blocked_range<size_t>(0, orderbooks.size()),
+		[this, current_block_number] (auto r) {
+			for (size_t i = r.begin(); i < r.end(); i++) {
+				if (orderbook_numa_nodes[i] >= 0) {
+					orderbooks[i].release_metadata_index();
+					orderbook_numa_nodes[i] = -1;
+				}
+				orderbooks[i].commit_for_production(current_block_number);
+			}
+		});
+}
+
+void OrderbookManager::compute_numa_node_bounds(size_t num_nodes) {
+	// Placement uses index sizes from the previous block,
+	// since this block's orderbooks are not yet merged.
+	numa_node_bounds.resize(num_nodes + 1);
+	split_by_cost(
+		0, 
+		orderbooks.size(), 
+		num_nodes, 
+		[this] (size_t i) {
+			return orderbooks[i].estimated_query_cost();
+		},
+		numa_node_bounds.begin());
+}
+
+void OrderbookManager::numa_commit_for_production(uint64_t current_block_number) {
+	if (!numa_arenas) {
+		numa_arenas = std::make_unique<NumaTaskArenas>();
+	}
+
+	compute_numa_node_bounds(numa_arenas->num_nodes());
+
+	// Nested tbb work (i.e. building a large index in parallel)
+	// stays in the node's arena, so it also runs on the node.
+	numa_arenas->run_on_each_node([this, current_block_number] (size_t node) {
+		tbb::parallel_for(
+			tbb::blocked_range<size_t>(numa_node_bounds[node], numa_node_bounds[node + 1]),
+			[this, node, current_block_number] (auto r) {
+				for (size_t i = r.begin(); i < r.end(); i++) {
+					if (orderbook_numa_nodes[i] != static_cast<int32_t>(node)) {
+						orderbooks[i].release_metadata_index();
+						orderbook_numa_nodes[i] = static_cast<int32_t>(node);
+					}
+					orderbooks[i].commit_for_production(current_block_number);
+				}
+			});
+	});
 }
 
 void OrderbookManager::commit_for_validation(
@@ -170,33 +243,34 @@ void OrderbookManager::rollback_thunks(uint64_t current_block_number) {
 	generic_map<&Orderbook::rollback_thunks>(current_block_number);
 }
 
-void OrderbookManager::persist_lmdb(uint64_t current_block_number) {
-	//orderbooks manage their own thunk threadsafety for persistence thunks
-
-	for (auto i = 0u; i < lmdb.get_num_base_instances(); i++) {
-		auto [start, end] = lmdb.get_base_instance_range(i);
-		auto& local_lmdb = lmdb.get_base_instance_by_index(i);
-		ThunkGarbage<OrderbookTrie::TrieT> garbage;
+void OrderbookManager::persist_lmdb_shard(size_t shard, uint64_t current_block_number) {
+	auto& local_lmdb = lmdb.get_base_instance_by_index(shard);
+	ThunkGarbage<OrderbookTrie::TrieT> garbage;
 
-		auto wtx = local_lmdb.wbegin();
+	auto wtx = local_lmdb.wbegin();
 
-		for (auto j = start; j < end; j++) {
+	for (size_t j : lmdb_shard_orderbooks[shard]) {
+		auto orderbook_garbage 
+			= orderbooks[j].persist_lmdb(current_block_number, wtx);
 
-			auto orderbook_garbage 
-				= orderbooks[j].persist_lmdb(current_block_number, wtx);
-
-			if (orderbook_garbage != nullptr) {
-				garbage.add(orderbook_garbage->release());
-			}
+		if (orderbook_garbage != nullptr) {
+			garbage.add(orderbook_garbage->release());
 		}
+	}
 
-		if constexpr (!DISABLE_LMDB)
-		{
-			local_lmdb.commit_wtxn(wtx, current_block_number);
-		}
-		
-		thunk_garbage_deleter.call_delete(garbage.release());
+	if constexpr (!DISABLE_LMDB)
+	{
+		local_lmdb.commit_wtxn(wtx, current_block_number);
 	}
+	
+	thunk_garbage_deleter.call_delete(garbage.release());
+}
+
+void OrderbookManager::persist_lmdb(uint64_t current_block_number) {
+	//orderbooks manage their own thunk threadsafety for persistence thunks
+	for_each_lmdb_shard([this, current_block_number] (size_t shard) {
+		persist_lmdb_shard(shard, current_block_number);
+	});
 }
 
 uint64_t 
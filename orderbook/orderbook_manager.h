@@ -19,6 +19,7 @@
 #pragma once 
 
 #include <cstdint>
+#include <memory>
 #include <mutex>
 #include <vector>
 
@@ -75,6 +76,7 @@ Rollback validation clears the persistence thunk that was just built.
 class AccountModificationLog;
 class BlockStateUpdateStatsWrapper;
 class ClearingParams;
+class NumaTaskArenas;
 class OrderbookStateCommitmentChecker;
 class ThreadsafeValidationStatistics;
 
@@ -102,12 +104,50 @@ class OrderbookManager {
 
 	OrderbookManagerLMDB lmdb;
 
+	bool use_numa_placement;
+
+	//! Orderbooks [numa_node_bounds[n], numa_node_bounds[n+1])
+	//! are placed on NUMA node n.  Empty if placement is off.
+	std::vector<size_t> numa_node_bounds;
+
+	//! Node on which each orderbook's index was last built
+	//! (-1 if not built by a node-pinned thread).
+	std::vector<int32_t> orderbook_numa_nodes;
+
+	//! Created on first use of NUMA-aware placement.
+	std::unique_ptr<NumaTaskArenas> numa_arenas;
+
+	//! Split orderbooks into contiguous, equal estimated
+	//! query cost ranges, one per node.
+	void compute_numa_node_bounds(size_t num_nodes);
+
+	//! commit_for_production(), with each orderbook merged and
+	//! indexed by threads pinned to the orderbook's node.
+	void numa_commit_for_production(uint64_t current_block_number);
+
+	//! Indices of the orderbooks stored in each lmdb shard.
+	std::vector<std::vector<size_t>> lmdb_shard_orderbooks;
+
+	//! One persistent persistence thread per lmdb shard.
+	std::vector<std::unique_ptr<detail::AsyncOrderbookLMDBShardWorker>> lmdb_shard_workers;
+
+	//! Run fn(shard) for every lmdb shard, each on its shard's worker
+	//! (lmdb write transactions cannot move between threads).
+	template<typename Fn>
+	void for_each_lmdb_shard(Fn&& fn);
+
+	//! Persist the thunks of the orderbooks in one lmdb shard,
+	//! in one write transaction.
+	void persist_lmdb_shard(size_t shard, uint64_t current_block_number);
+
 public:
 
 	using prefix_t = OrderbookTriePrefix;
 
 	OrderbookManager(uint16_t num_new_assets);
 
+	~OrderbookManager();
+
 	OrderbookManager(const OrderbookManager& other) = delete;
 	OrderbookManager(OrderbookManager&& other) = delete;
 
@@ -128,6 +168,18 @@ public:
 		orderbooks[idx].unmark_for_deletion(key);
 	}
 
+	//! Claim an existing offer for a cancellation in block production.
+	//! The offer is marked for deletion when the block is committed.
+	//! Returns nullopt if offer did not exist or was already claimed.
+	std::optional<Offer> claim_for_deletion(int idx, const prefix_t& key) {
+		return orderbooks[idx].claim_for_deletion(key);
+	}
+
+	//! Release a claim made by claim_for_deletion().
+	void release_deletion_claim(int idx, const prefix_t& key) {
+		orderbooks[idx].release_deletion_claim(key);
+	}
+
 	//! Get the persistence round of orderbook index \a idx.
 	uint64_t get_persisted_round_number(int idx) {
 		return orderbooks[idx].get_persisted_round_number();
@@ -151,6 +203,16 @@ public:
 		return get_num_orderbooks_by_asset_count(num_assets);
 	}
 
+	//! Depth snapshot of orderbook \a idx, as of the last
+	//! commit_for_production() (nullptr if none yet).
+	//! Does not take the manager's lock, so market data queries can
+	//! run concurrently with block processing (but not with
+	//! increase_num_traded_assets()).
+	std::shared_ptr<const OrderbookDepthSnapshot> 
+	get_depth_snapshot(int idx) const {
+		return orderbooks[idx].get_depth_snapshot();
+	}
+
 	size_t get_work_unit_size(int idx) const {
 		return orderbooks[idx].size();
 	}
@@ -201,6 +263,19 @@ public:
 	//! Commit orderbooks when operating in block production mode.
 	void commit_for_production(uint64_t current_block_number);
 
+	//! Turn NUMA-aware placement on or off (default NUMA_AWARE_PLACEMENT)
+	//! for subsequent calls to commit_for_production().
+	void set_numa_placement(bool enable) {
+		use_numa_placement = enable;
+	}
+
+	//! Orderbook range placed on each NUMA node by the last
+	//! commit_for_production() (node n has orderbooks
+	//! [out[n], out[n+1])).  Empty if placement was off.
+	const std::vector<size_t>& get_numa_node_bounds() const {
+		return numa_node_bounds;
+	}
+
 	//! Tentatively commit when operating in block validation mode.
 	//! Only difference from commit_for_production() is that this
 	//! does not generate a metadata index for each orderbook.
@@ -93,7 +93,7 @@ ProcessingSerialManager::undelete_offer(
         min_price, owner, offer_id, BaseSerialManager::key_buf);
     
     BaseSerialManager<OrderbookManager>::main_manager
-        .unmark_for_deletion(idx, key_buf);
+        .release_deletion_claim(idx, key_buf);
 }
 
 void 
@@ -26,7 +26,9 @@ a set of changes to the manager.
 
 (Marking offers as deleted is not buffered locally, but marked in the main
 manager's tries, and the actual trie manipulations to delete offers are done
-later).
+later.  In block production, cancellations instead claim offers in the main
+manager, which marks each orderbook's claimed offers in one sorted pass when
+the block is committed).
 
 In this design, the memory database must be persisted before the orderbooks.
 When an offer is cancelled, the amount the offer had for sale is returned to
@@ -193,6 +195,20 @@ public:
 	constexpr static bool maintain_account_log = true;
 
 
+	/*! Cancel an offer in the main orderbook manager.
+	The offer is claimed, not marked in the orderbook's trie, so
+	concurrent cancellations do not contend on trie paths.
+	*/
+	std::optional<Offer> delete_offer(
+		const int idx, 
+		const Price min_price, 
+		const AccountID owner, 
+		const uint64_t offer_id) {
+		ensure_suffient_new_offers_sz(idx);
+		generate_orderbook_trie_key(min_price, owner, offer_id, key_buf);
+		return main_manager.claim_for_deletion(idx, key_buf);
+	}
+
 	/*! Undo a call to delete_offer */
 	void undelete_offer(
 		const int idx, 
@@ -0,0 +1,633 @@
+/**
+ * SPEEDEX: A Scalable, Parallelizable, and Economically Efficient Decentralized Exchange
+ * Copyright (C) 2023 Geoffrey Ramseyer
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "orderbook/price_index.h"
+
+#include <algorithm>
+#include <atomic>
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+namespace speedex {
+
+//! Number of entries of the sorted array a[0..n) that are at most p.
+//! Branchless, so that searches for different orderbooks overlap.
+template<typename T>
+static size_t
+count_at_most(const T* a, size_t n, T p) {
+	if (n == 0) {
+		return 0;
+	}
+	const T* base = a;
+	while (n > 1) {
+		size_t half = n / 2;
+		base = (base[half] <= p) ? base + half : base;
+		n -= half;
+	}
+	return (base - a) + (*base <= p);
+}
+
+//! Same as count_at_most, for the (short) key array of one block.
+//! A linear scan vectorizes, and beats the search at this size.
+static size_t
+count_in_block(const Price* keys, size_t n, Price p) {
+	size_t count = 0;
+	for (size_t i = 0; i < n; i++) {
+		count += (keys[i] <= p);
+	}
+	return count;
+}
+
+//! Number of leading indices in [0, n) that satisfy pred
+//! (which holds on a prefix of [0, n)).
+template<typename Pred>
+static size_t
+count_prefix(size_t n, Pred&& pred) {
+	size_t count = 0;
+	while (n > 0) {
+		size_t half = n / 2;
+		if (pred(count + half)) {
+			count += half + 1;
+			n -= half + 1;
+		} else {
+			n = half;
+		}
+	}
+	return count;
+}
+
+void
+OrderbookPriceIndex::clear() {
+	blocks.clear();
+	block_first_keys.clear();
+	block_prefixes.clear();
+	block_ranks.clear();
+	refresh_from = 0;
+	num_levels = 0;
+	append_base = EndowAccumulator{};
+	append_total = EndowAccumulator{};
+}
+
+void
+OrderbookPriceIndex::reserve(size_t num_levels) {
+	size_t num_blocks = num_levels / BLOCK_FILL + 1;
+	blocks.reserve(num_blocks);
+	block_first_keys.reserve(num_blocks);
+	block_prefixes.reserve(num_blocks);
+	block_ranks.reserve(num_blocks);
+}
+
+void
+OrderbookPriceIndex::insert_block(size_t idx, std::shared_ptr<Block> block) {
+	block_first_keys.insert(block_first_keys.begin() + idx, block->keys[0]);
+	blocks.insert(blocks.begin() + idx, std::move(block));
+	block_prefixes.emplace_back();
+	block_ranks.emplace_back();
+	refresh_from = std::min(refresh_from, idx);
+}
+
+void
+OrderbookPriceIndex::erase_block(size_t idx) {
+	blocks.erase(blocks.begin() + idx);
+	block_first_keys.erase(block_first_keys.begin() + idx);
+	block_prefixes.pop_back();
+	block_ranks.pop_back();
+	refresh_from = std::min(refresh_from, idx);
+}
+
+static_assert(__STDCPP_DEFAULT_NEW_ALIGNMENT__ >= alignof(__int128),
+	"block storage must be aligned for its endow_times_prices");
+
+OrderbookPriceIndex::Block::Block(size_t capacity)
+	: capacity(capacity)
+	, storage(std::make_unique<std::byte[]>(
+		capacity * (sizeof(int128_t) + sizeof(Price) + sizeof(int64_t))))
+	, endow_times_prices(reinterpret_cast<int128_t*>(storage.get()))
+	, keys(reinterpret_cast<Price*>(endow_times_prices + capacity))
+	, endows(reinterpret_cast<int64_t*>(keys + capacity)) {}
+
+OrderbookPriceIndex::Block::Block(const Block& other, size_t capacity)
+	: Block(capacity) {
+	size = other.size;
+	std::copy(other.keys, other.keys + size, keys);
+	std::copy(other.endows, other.endows + size, endows);
+	std::copy(other.endow_times_prices, other.endow_times_prices + size, endow_times_prices);
+}
+
+size_t
+OrderbookPriceIndex::capacity_for(size_t size) {
+	if (size >= BLOCK_FILL) {
+		return BLOCK_CAPACITY;
+	}
+	size = std::max<size_t>(size, 1);
+	return (size + MIN_BLOCK_CAPACITY - 1) / MIN_BLOCK_CAPACITY * MIN_BLOCK_CAPACITY;
+}
+
+std::shared_ptr<OrderbookPriceIndex::Block>
+OrderbookPriceIndex::new_block(size_t capacity) const {
+	auto block = std::make_shared<Block>(capacity);
+	block->epoch = share_epoch.get();
+	return block;
+}
+
+void
+OrderbookPriceIndex::grow_block(size_t idx) {
+	const Block& old = *blocks[idx];
+	auto block = std::make_shared<Block>(
+		old, std::min<size_t>(old.capacity * 2, BLOCK_CAPACITY));
+	block->epoch = share_epoch.get();
+	blocks[idx] = std::move(block);
+}
+
+OrderbookPriceIndex::Block&
+OrderbookPriceIndex::mutable_block(size_t idx) {
+	// Only the thread that owns the index modifies it (or copies it
+	// while it is modified), so the epoch cannot change here.
+	const uint64_t epoch = share_epoch.get();
+	if (blocks[idx]->epoch != epoch) {
+		blocks[idx] = std::make_shared<Block>(*blocks[idx], blocks[idx]->capacity);
+		blocks[idx]->epoch = epoch;
+	}
+	return *blocks[idx];
+}
+
+void
+OrderbookPriceIndex::append_level(Price key, const EndowAccumulator& cumulative) {
+	if (blocks.empty() || blocks.back()->size == BLOCK_FILL) {
+		append_base = append_total;
+		auto block = new_block(MIN_BLOCK_CAPACITY);
+		block->keys[0] = key;
+		insert_block(blocks.size(), std::move(block));
+	} else if (blocks.back()->size == blocks.back()->capacity) {
+		grow_block(blocks.size() - 1);
+	}
+	Block& block = mutable_block(blocks.size() - 1);
+	block.keys[block.size] = key;
+	block.endows[block.size] = cumulative.endow - append_base.endow;
+	block.endow_times_prices[block.size]
+		= cumulative.endow_times_price - append_base.endow_times_price;
+	block.size++;
+
+	append_total = cumulative;
+	num_levels++;
+}
+
+void
+OrderbookPriceIndex::finalize() {
+	for (size_t b = refresh_from; b < blocks.size(); b++) {
+		if (b == 0) {
+			block_prefixes[0] = EndowAccumulator{};
+			block_ranks[0] = 1;
+		} else {
+			block_prefixes[b] = block_prefixes[b - 1];
+			block_prefixes[b] += blocks[b - 1]->total();
+			block_ranks[b] = block_ranks[b - 1] + blocks[b - 1]->size;
+		}
+	}
+	refresh_from = blocks.size();
+}
+
+std::pair<size_t, size_t>
+OrderbookPriceIndex::locate(size_t idx) const {
+	size_t b = count_at_most(block_ranks.data(), block_ranks.size(), idx) - 1;
+	return {b, idx - block_ranks[b]};
+}
+
+size_t
+OrderbookPriceIndex::upper_bound_idx(Price p) const {
+	size_t b = count_at_most(block_first_keys.data(), block_first_keys.size(), p);
+	if (b == 0) {
+		return 0;
+	}
+	const Block& block = *blocks[b - 1];
+	return block_ranks[b - 1] + count_in_block(block.keys, block.size, p) - 1;
+}
+
+size_t
+OrderbookPriceIndex::first_idx_with_endow_above(int64_t amount) const {
+	// Every level of a block before the last block whose prefix
+	// is at most amount has endowment at most amount.
+	size_t b = count_prefix(blocks.size(),
+		[&] (size_t b) { return block_prefixes[b].endow <= amount; });
+	if (b == 0) {
+		return 1;
+	}
+	const Block& block = *blocks[b - 1];
+	const int64_t remaining = amount - block_prefixes[b - 1].endow;
+	size_t i = count_prefix(block.size,
+		[&] (size_t i) { return block.endows[i] <= remaining; });
+	return block_ranks[b - 1] + i;
+}
+
+size_t
+OrderbookPriceIndex::first_idx_with_endow_at_least(int64_t amount) const {
+	size_t b = count_prefix(blocks.size(),
+		[&] (size_t b) { return block_prefixes[b].endow < amount; });
+	if (b == 0) {
+		return 1;
+	}
+	const Block& block = *blocks[b - 1];
+	const int64_t remaining = amount - block_prefixes[b - 1].endow;
+	size_t i = count_prefix(block.size,
+		[&] (size_t i) { return block.endows[i] < remaining; });
+	return block_ranks[b - 1] + i;
+}
+
+EndowAccumulator
+OrderbookPriceIndex::lookup(Price p) const {
+	size_t b = count_at_most(block_first_keys.data(), block_first_keys.size(), p);
+	if (b == 0) {
+		return EndowAccumulator{};
+	}
+	const Block& block = *blocks[b - 1];
+	EndowAccumulator out = block_prefixes[b - 1];
+	out += block.metadata(count_in_block(block.keys, block.size, p) - 1);
+	return out;
+}
+
+EndowAccumulator
+OrderbookPriceIndex::lookup_excluding_top_level(Price p) const {
+	if (num_levels > 0) {
+		const Block& top = *blocks.back();
+		if (p == top.keys[top.size - 1]) {
+			return metadata(num_levels - 1);
+		}
+	}
+	return lookup(p);
+}
+
+void
+OrderbookPriceIndex::split_block(size_t idx) {
+	Block& lower = mutable_block(idx);
+	auto upper = new_block(BLOCK_CAPACITY);
+
+	const size_t lower_size = lower.size / 2;
+	const EndowAccumulator base = lower.metadata(lower_size - 1);
+
+	upper->size = lower.size - lower_size;
+	for (size_t i = 0; i < upper->size; i++) {
+		upper->keys[i] = lower.keys[lower_size + i];
+		upper->endows[i] = lower.endows[lower_size + i] - base.endow;
+		upper->endow_times_prices[i]
+			= lower.endow_times_prices[lower_size + i] - base.endow_times_price;
+	}
+	lower.size = lower_size;
+
+	insert_block(idx + 1, std::move(upper));
+}
+
+bool
+OrderbookPriceIndex::update_level(Price key, int64_t endow_delta) {
+	if (endow_delta == 0) {
+		return true;
+	}
+
+	// last block starting at or below key (or the first block)
+	size_t b = count_at_most(block_first_keys.data(), block_first_keys.size(), key);
+	b = (b == 0) ? 0 : b - 1;
+
+	if (blocks.empty()) {
+		if (endow_delta < 0) {
+			return false;
+		}
+		insert_block(0, new_block(MIN_BLOCK_CAPACITY));
+	}
+
+	Block* block = &mutable_block(b);
+	size_t i = count_at_most(block->keys, block->size, key);
+
+	if (i > 0 && block->keys[i - 1] == key) {
+		// existing level
+		i--;
+		int64_t new_level_endow = block->level_endow(i) + endow_delta;
+		if (new_level_endow < 0) {
+			return false;
+		}
+		if (new_level_endow == 0) {
+			// Offer amounts are positive, so a level with
+			// no endowment has no offers.
+			block->add_from(i, key, endow_delta);
+			std::copy(block->keys + i + 1, block->keys + block->size, block->keys + i);
+			std::copy(block->endows + i + 1, block->endows + block->size, block->endows + i);
+			std::copy(block->endow_times_prices + i + 1,
+				block->endow_times_prices + block->size,
+				block->endow_times_prices + i);
+			block->size--;
+			num_levels--;
+			if (block->size == 0) {
+				erase_block(b);
+				return true;
+			}
+		} else {
+			block->add_from(i, key, endow_delta);
+		}
+	} else {
+		// new level, inserted before position i
+		if (endow_delta < 0) {
+			return false;
+		}
+		if (block->size == block->capacity && block->capacity < BLOCK_CAPACITY) {
+			grow_block(b);
+			block = blocks[b].get();
+		} else if (block->size == BLOCK_CAPACITY) {
+			split_block(b);
+			if (i > blocks[b]->size) {
+				i -= blocks[b]->size;
+				b++;
+			}
+			block = blocks[b].get();
+		}
+		std::copy_backward(block->keys + i, block->keys + block->size, block->keys + block->size + 1);
+		std::copy_backward(block->endows + i, block->endows + block->size, block->endows + block->size + 1);
+		std::copy_backward(block->endow_times_prices + i,
+			block->endow_times_prices + block->size,
+			block->endow_times_prices + block->size + 1);
+		block->size++;
+		num_levels++;
+
+		block->keys[i] = key;
+		block->endows[i] = (i > 0) ? block->endows[i - 1] : 0;
+		block->endow_times_prices[i] = (i > 0) ? block->endow_times_prices[i - 1] : 0;
+		block->add_from(i, key, endow_delta);
+	}
+
+	block_first_keys[b] = block->keys[0];
+	refresh_from = std::min(refresh_from, b + 1);
+	return true;
+}
+
+bool
+OrderbookPriceIndex::truncate_below(Price key, int64_t removed_endow) {
+	size_t b = count_at_most(block_first_keys.data(), block_first_keys.size(), key);
+	if (b == 0) {
+		return false;
+	}
+	b--;
+
+	const Block& shared_block = *blocks[b];
+	size_t i = count_at_most(shared_block.keys, shared_block.size, key) - 1;
+	if (shared_block.keys[i] != key) {
+		return false;
+	}
+
+	// endowment remaining at key
+	EndowAccumulator through_key = block_prefixes[b];
+	through_key += shared_block.metadata(i);
+	int64_t remaining = through_key.endow - removed_endow;
+	if (remaining < 0) {
+		return false;
+	}
+
+	// Rebase the remaining levels of the block to start from the
+	// remaining endowment at key (dropping key if nothing remains).
+	Block& block = mutable_block(b);
+	EndowAccumulator base = block.metadata(i);
+	base.endow -= remaining;
+	base.endow_times_price -= static_cast<int128_t>(remaining) * key;
+
+	const size_t first = (remaining == 0) ? i + 1 : i;
+	size_t new_size = 0;
+	for (size_t j = first; j < block.size; j++) {
+		block.keys[new_size] = block.keys[j];
+		block.endows[new_size] = block.endows[j] - base.endow;
+		block.endow_times_prices[new_size] = block.endow_times_prices[j] - base.endow_times_price;
+		new_size++;
+	}
+	num_levels -= (block_ranks[b] - 1) + first;
+	block.size = new_size;
+
+	blocks.erase(blocks.begin(), blocks.begin() + b);
+	block_first_keys.erase(block_first_keys.begin(), block_first_keys.begin() + b);
+	block_prefixes.resize(blocks.size());
+	block_ranks.resize(blocks.size());
+	refresh_from = 0;
+
+	if (blocks[0]->size == 0) {
+		erase_block(0);
+	} else {
+		block_first_keys[0] = blocks[0]->keys[0];
+	}
+	return true;
+}
+
+void
+OrderbookPriceIndex::assign_levels(
+	const std::vector<Price>& keys, const std::vector<int64_t>& level_endows)
+{
+	clear();
+
+	const size_t n = keys.size();
+	const size_t num_blocks = (n + BLOCK_FILL - 1) / BLOCK_FILL;
+
+	blocks.resize(num_blocks);
+	block_first_keys.resize(num_blocks);
+	block_prefixes.resize(num_blocks);
+	block_ranks.resize(num_blocks);
+
+	tbb::parallel_for(
+		tbb::blocked_range<size_t>(0, num_blocks, PARALLEL_GRAIN / BLOCK_FILL),
+		[&] (auto r) {
+			for (size_t b = r.begin(); b < r.end(); b++) {
+				const size_t start = b * BLOCK_FILL;
+				const size_t size = std::min(n - start, BLOCK_FILL);
+				auto block = new_block(capacity_for(size));
+				block->size = size;
+				for (size_t i = 0; i < block->size; i++) {
+					block->keys[i] = keys[start + i];
+					block->endows[i] = level_endows[start + i];
+					block->endow_times_prices[i]
+						= static_cast<int128_t>(level_endows[start + i]) * keys[start + i];
+					if (i > 0) {
+						block->endows[i] += block->endows[i - 1];
+						block->endow_times_prices[i] += block->endow_times_prices[i - 1];
+					}
+				}
+				block_first_keys[b] = block->keys[0];
+				blocks[b] = std::move(block);
+			}
+		});
+
+	num_levels = n;
+	refresh_from = 0;
+	finalize();
+}
+
+bool
+OrderbookPriceIndex::merge_changes(const std::vector<std::pair<Price, int64_t>>& changes) {
+	finalize();
+
+	// Flatten the current levels.
+	std::vector<Price> old_keys(num_levels);
+	std::vector<int64_t> old_endows(num_levels);
+	tbb::parallel_for(
+		tbb::blocked_range<size_t>(0, blocks.size(), PARALLEL_GRAIN / BLOCK_FILL),
+		[&] (auto r) {
+			for (size_t b = r.begin(); b < r.end(); b++) {
+				const Block& block = *blocks[b];
+				const size_t start = block_ranks[b] - 1;
+				for (size_t i = 0; i < block.size; i++) {
+					old_keys[start + i] = block.keys[i];
+					old_endows[start + i] = block.level_endow(i);
+				}
+			}
+		});
+
+	const size_t num_old = num_levels;
+	const size_t num_changes = changes.size();
+
+	// Chunk c merges old levels [level_bounds[c], level_bounds[c+1])
+	// with changes [change_bounds[c], change_bounds[c+1]).
+	// Old levels are split evenly, and each change goes to the
+	// chunk whose levels cover its price.
+	const size_t num_chunks = 1 + num_old / PARALLEL_GRAIN;
+
+	std::vector<size_t> level_bounds(num_chunks + 1), change_bounds(num_chunks + 1);
+	for (size_t c = 0; c <= num_chunks; c++) {
+		level_bounds[c] = (num_old * c) / num_chunks;
+	}
+	change_bounds[0] = 0;
+	change_bounds[num_chunks] = num_changes;
+	for (size_t c = 1; c < num_chunks; c++) {
+		Price split = old_keys[level_bounds[c]];
+		change_bounds[c] = std::lower_bound(
+			changes.begin(), changes.end(), split,
+			[] (const auto& change, Price p) { return change.first < p; })
+			- changes.begin();
+	}
+
+	// Calls emit(price, level endow) on each level of the result
+	// within chunk c, in order.  Returns false on a negative level.
+	auto merge_chunk = [&] (size_t c, auto&& emit) -> bool {
+		size_t i = level_bounds[c], j = change_bounds[c];
+		const size_t i_end = level_bounds[c + 1], j_end = change_bounds[c + 1];
+
+		while (i < i_end || j < j_end) {
+			Price p;
+			int64_t endow = 0;
+			if (j == j_end || (i < i_end && old_keys[i] < changes[j].first)) {
+				p = old_keys[i];
+				endow = old_endows[i++];
+			} else if (i == i_end || changes[j].first < old_keys[i]) {
+				p = changes[j].first;
+				endow = changes[j++].second;
+			} else {
+				p = old_keys[i];
+				endow = old_endows[i++] + changes[j++].second;
+			}
+			if (endow < 0) {
+				return false;
+			}
+			// Offer amounts are positive, so a level with no
+			// endowment has no offers.
+			if (endow > 0) {
+				emit(p, endow);
+			}
+		}
+		return true;
+	};
+
+	// Pass 1: size of each chunk.
+	std::vector<size_t> offsets(num_chunks + 1, 0);
+	std::atomic<bool> error = false;
+	tbb::parallel_for(
+		tbb::blocked_range<size_t>(0, num_chunks, 1),
+		[&] (auto r) {
+			for (size_t c = r.begin(); c < r.end(); c++) {
+				size_t count = 0;
+				if (!merge_chunk(c, [&count] (Price, int64_t) { count++; })) {
+					error = true;
+				}
+				offsets[c + 1] = count;
+			}
+		});
+
+	if (error) {
+		return false;
+	}
+
+	for (size_t c = 0; c < num_chunks; c++) {
+		offsets[c + 1] += offsets[c];
+	}
+
+	// Pass 2: write merged levels.
+	std::vector<Price> new_keys(offsets[num_chunks]);
+	std::vector<int64_t> new_endows(offsets[num_chunks]);
+	tbb::parallel_for(
+		tbb::blocked_range<size_t>(0, num_chunks, 1),
+		[&] (auto r) {
+			for (size_t c = r.begin(); c < r.end(); c++) {
+				size_t out = offsets[c];
+				merge_chunk(c, [&] (Price p, int64_t endow) {
+					new_keys[out] = p;
+					new_endows[out] = endow;
+					out++;
+				});
+			}
+		});
+
+	assign_levels(new_keys, new_endows);
+	return true;
+}
+
+bool
+OrderbookPriceIndex::apply_changes(PriceIndexChangeLog& log) {
+	if (!log.valid) {
+		return false;
+	}
+
+	auto& changes = log.offer_changes;
+
+	// Merge changes at the same price.
+	std::sort(changes.begin(), changes.end(),
+		[] (const auto& a, const auto& b) { return a.first < b.first; });
+	size_t num_changes = 0;
+	for (size_t i = 0; i < changes.size(); i++) {
+		if (num_changes > 0 && changes[num_changes - 1].first == changes[i].first) {
+			changes[num_changes - 1].second += changes[i].second;
+		} else {
+			changes[num_changes++] = changes[i];
+		}
+	}
+	changes.resize(num_changes);
+
+	if (log.cleared_all) {
+		clear();
+	} else if (log.has_clearing && !truncate_below(log.clearing_price, log.clearing_endow)) {
+		return false;
+	}
+
+	if (changes.size() * INCREMENTAL_CHANGE_FRACTION <= num_levels) {
+		for (auto const& [key, endow_delta] : changes) {
+			if (!update_level(key, endow_delta)) {
+				return false;
+			}
+		}
+		// Deletions can leave many small blocks.
+		if (blocks.size() > 2 * (num_levels / BLOCK_FILL + 1)) {
+			merge_changes({});
+		}
+	} else if (!merge_changes(changes)) {
+		return false;
+	}
+
+	finalize();
+	return true;
+}
+
+} /* speedex */
@@ -0,0 +1,388 @@
+/**
+ * SPEEDEX: A Scalable, Parallelizable, and Economically Efficient Decentralized Exchange
+ * Copyright (C) 2023 Geoffrey Ramseyer
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/*! \file price_index.h
+
+Lookup structure over the cumulative endowments of an orderbook,
+keyed by price.  Tatonnement queries this index (twice per orderbook)
+in every round, so the layout is designed for lookups.
+
+Most offers persist from one block to the next, so the index is
+persistent: it is updated with the offers added, deleted, and cleared
+since the last block (PriceIndexChangeLog), instead of rebuilt from
+the orderbook trie.
+
+Price levels are stored in sorted blocks of at most BLOCK_CAPACITY
+levels, each holding endowments cumulative within the block
+(structure-of-arrays, so that a lookup only touches the metadata it
+returns).  Adding or removing a price level only shifts one block.
+A block that is not full (e.g. the only block of a sparse orderbook)
+is allocated for its contents, and grows before it splits.
+The cumulative endowment before each block is kept in a separate
+array, which is refreshed (from the first modified block onwards)
+before the index is next queried.
+
+Copies of an index share its blocks (copy-on-write), so a copy (e.g.
+a depth snapshot) costs O(number of blocks), and a block is only
+duplicated when one of the copies first modifies it.  Whether a block
+may be shared is decided by epochs, not by reference counts (which
+other threads change concurrently when they drop a copy).
+*/
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "orderbook/helpers.h"
+
+#include "xdr/types.h"
+
+namespace speedex {
+
+/*! Changes to an orderbook's offers since its price index was built.
+
+Records, in order, at most one clearing (which removes every offer
+below the partially executing offer, and part of that offer), and then
+any number of offers added or deleted.  Changes of any other kind
+(e.g. rolling back a block) invalidate the log.
+*/
+class PriceIndexChangeLog {
+
+	friend class OrderbookPriceIndex;
+
+	bool valid = false;
+
+	bool has_clearing = false;
+	//! Clearing removed every offer.
+	bool cleared_all = false;
+	//! minPrice of the partially executing offer.
+	Price clearing_price = 0;
+	//! Endowment removed from levels at or below clearing_price.
+	int64_t clearing_endow = 0;
+
+	//! (minPrice, change in endowment) of added and deleted offers.
+	std::vector<std::pair<Price, int64_t>> offer_changes;
+
+public:
+
+	//! Start logging against a freshly built index.
+	void reset() {
+		valid = true;
+		has_clearing = false;
+		cleared_all = false;
+		offer_changes.clear();
+	}
+
+	void invalidate() {
+		valid = false;
+		offer_changes.clear();
+	}
+
+	bool is_valid() const {
+		return valid;
+	}
+
+	size_t size() const {
+		return offer_changes.size();
+	}
+
+	void log_offer_change(Price min_price, int64_t endow_delta) {
+		if (valid) {
+			offer_changes.emplace_back(min_price, endow_delta);
+		}
+	}
+
+	//! All offers with key below the partial execution key are
+	//! cleared, removing \a removed_endow in total (including the
+	//! executed part of the partial execution offer).
+	void log_clearing(Price partial_exec_price, int64_t removed_endow) {
+		if (has_clearing || offer_changes.size() > 0) {
+			invalidate();
+		}
+		has_clearing = true;
+		clearing_price = partial_exec_price;
+		clearing_endow = removed_endow;
+	}
+
+	void log_clear_all() {
+		if (has_clearing || offer_changes.size() > 0) {
+			invalidate();
+		}
+		has_clearing = true;
+		cleared_all = true;
+	}
+};
+
+/*! Index of an orderbook's offers, aggregated by price level.
+
+Entry 0 is a sentinel (price 0, empty metadata).  Entry i (i >= 1)
+is the i'th lowest distinct minPrice among the orderbook's offers, along
+with the total endowment (and endowment times price) of all offers
+with minPrice at most that price.
+
+Build with clear(), then append_level() in increasing price order,
+then finalize(), or update a finalized index with apply_changes().
+Lookups are only valid after finalize() (or apply_changes()).
+*/
+class OrderbookPriceIndex {
+
+	using int128_t = __int128;
+
+public:
+
+	constexpr static size_t BLOCK_CAPACITY = 128;
+
+private:
+
+	//! Levels per block after a bulk build, leaving room for inserts.
+	constexpr static size_t BLOCK_FILL = BLOCK_CAPACITY * 3 / 4;
+
+	//! Blocks' capacities are multiples of this.
+	constexpr static size_t MIN_BLOCK_CAPACITY = 8;
+
+	//! Levels handled by one task when patching in parallel.
+	constexpr static size_t PARALLEL_GRAIN = 1 << 14;
+
+	//! Changes are applied one by one (instead of merged into
+	//! a rebuilt index) if there are at most
+	//! 1/INCREMENTAL_CHANGE_FRACTION as many as price levels.
+	constexpr static size_t INCREMENTAL_CHANGE_FRACTION = 16;
+
+	//! A run of consecutive price levels.  endows and
+	//! endow_times_prices are cumulative within the block.
+	//! The arrays share one allocation of \a capacity levels.
+	struct Block {
+		uint32_t size = 0;
+		const uint32_t capacity;
+		//! share_epoch of the index when this block was created.
+		uint64_t epoch = 0;
+
+	private:
+		std::unique_ptr<std::byte[]> storage;
+
+	public:
+		int128_t* const endow_times_prices;
+		Price* const keys;
+		int64_t* const endows;
+
+		explicit Block(size_t capacity);
+		//! Copy of the levels of \a other (capacity at least other.size).
+		Block(const Block& other, size_t capacity);
+
+		Block(const Block&) = delete;
+		Block& operator=(const Block&) = delete;
+
+		EndowAccumulator metadata(size_t idx) const {
+			EndowAccumulator out;
+			out.endow = endows[idx];
+			out.endow_times_price = endow_times_prices[idx];
+			return out;
+		}
+
+		EndowAccumulator total() const {
+			return (size > 0) ? metadata(size - 1) : EndowAccumulator{};
+		}
+
+		int64_t level_endow(size_t idx) const {
+			return endows[idx] - ((idx > 0) ? endows[idx - 1] : 0);
+		}
+
+		//! Add \a endow at \a key to levels [idx, size).
+		void add_from(size_t idx, Price key, int64_t endow) {
+			int128_t endow_times_price = static_cast<int128_t>(endow) * key;
+			for (size_t i = idx; i < size; i++) {
+				endows[i] += endow;
+				endow_times_prices[i] += endow_times_price;
+			}
+		}
+	};
+
+	/*! Copying an index advances the epoch of both the original and
+	the copy, so every block that exists at that point has an older
+	epoch in both.  A block whose epoch equals the index's
+	current epoch was created after the last copy, so no other index
+	can hold it.  Atomic so that readers may copy a shared
+	(const) index concurrently.
+	*/
+	struct ShareEpoch {
+		mutable std::atomic<uint64_t> value = 0;
+
+		ShareEpoch() = default;
+		ShareEpoch(const ShareEpoch& other)
+			: value(other.value.fetch_add(1, std::memory_order_relaxed) + 1) {}
+		ShareEpoch& operator=(const ShareEpoch& other) {
+			value = other.value.fetch_add(1, std::memory_order_relaxed) + 1;
+			return *this;
+		}
+		//! A move transfers the blocks, so nothing becomes shared.
+		ShareEpoch(ShareEpoch&& other)
+			: value(other.value.load(std::memory_order_relaxed)) {}
+		ShareEpoch& operator=(ShareEpoch&& other) {
+			value = other.value.load(std::memory_order_relaxed);
+			return *this;
+		}
+
+		uint64_t get() const {
+			return value.load(std::memory_order_relaxed);
+		}
+	};
+
+	//! Shared with copies of the index; only modified through
+	//! mutable_block().
+	std::vector<std::shared_ptr<Block>> blocks;
+	//! First key of each block, for locating blocks.
+	std::vector<Price> block_first_keys;
+	//! Cumulative metadata of all levels before each block.
+	std::vector<EndowAccumulator> block_prefixes;
+	//! Entry index (in the sense of key(idx)) of each block's first level.
+	std::vector<size_t> block_ranks;
+	//! block_prefixes and block_ranks are stale from this block onwards.
+	size_t refresh_from = 0;
+
+	size_t num_levels = 0;
+
+	//! For append_level(): cumulative metadata before the last block,
+	//! and up to the last level.
+	EndowAccumulator append_base;
+	EndowAccumulator append_total;
+
+	ShareEpoch share_epoch;
+
+	//! Capacity of a block allocated for \a size levels.
+	static size_t capacity_for(size_t size);
+
+	//! A new (empty) block, owned by this index.
+	std::shared_ptr<Block> new_block(size_t capacity) const;
+
+	//! Replace block \a idx by a copy with room for more levels.
+	void grow_block(size_t idx);
+
+	void insert_block(size_t idx, std::shared_ptr<Block> block);
+	void erase_block(size_t idx);
+
+	//! Block \a idx, first duplicated if a copy of the index shares it.
+	Block& mutable_block(size_t idx);
+
+	//! Split block idx in half.
+	void split_block(size_t idx);
+
+	//! Add \a endow_delta to the level at \a key (inserting or
+	//! removing the level as needed).
+	//! Returns false if the level's endowment would become negative.
+	bool update_level(Price key, int64_t endow_delta);
+
+	//! Remove levels below \a key, and reduce the level at \a key
+	//! by \a removed_endow minus the endowment of those levels.
+	//! Requires fresh block_prefixes.
+	bool truncate_below(Price key, int64_t removed_endow);
+
+	//! Rebuild with the given levels (sorted, not cumulative).
+	void assign_levels(const std::vector<Price>& keys, const std::vector<int64_t>& level_endows);
+
+	//! Merge changes (sorted, one per price) into the index,
+	//! rebuilding it.
+	bool merge_changes(const std::vector<std::pair<Price, int64_t>>& changes);
+
+	//! Block and offset of entry \a idx (idx >= 1).
+	std::pair<size_t, size_t> locate(size_t idx) const;
+
+public:
+
+	OrderbookPriceIndex() {
+		clear();
+		finalize();
+	}
+
+	//! Reset to an empty index (just the sentinel).
+	void clear();
+
+	void reserve(size_t num_levels);
+
+	//! Add the next price level.  Keys must be strictly increasing,
+	//! and \a cumulative includes all offers up to and including \a key.
+	void append_level(Price key, const EndowAccumulator& cumulative);
+
+	//! Prepare for lookups.  Call after appending all levels.
+	void finalize();
+
+	//! Update a finalized index by the changes in \a log
+	//! (which must be valid, and is left in an unspecified order),
+	//! and finalize it.
+	//! Returns false if the log is inconsistent with the index, in
+	//! which case the index is left in an unspecified state (and
+	//! should be rebuilt).
+	bool apply_changes(PriceIndexChangeLog& log);
+
+	//! Number of entries, including the sentinel.
+	size_t size() const {
+		return num_levels + 1;
+	}
+
+	Price key(size_t idx) const {
+		if (idx == 0) {
+			return 0;
+		}
+		auto [b, i] = locate(idx);
+		return blocks[b]->keys[i];
+	}
+
+	int64_t endow(size_t idx) const {
+		return metadata(idx).endow;
+	}
+
+	EndowAccumulator metadata(size_t idx) const {
+		if (idx == 0) {
+			return EndowAccumulator{};
+		}
+		auto [b, i] = locate(idx);
+		EndowAccumulator out = block_prefixes[b];
+		out += blocks[b]->metadata(i);
+		return out;
+	}
+
+	//! Index of the last entry with key at most \a p
+	//! (0, the sentinel, if p is below every price level).
+	size_t upper_bound_idx(Price p) const;
+
+	//! Index of the first entry (after the sentinel) whose cumulative
+	//! endowment exceeds \a amount (size() if there is none).
+	//! Searches the blocks' endowments directly, instead of
+	//! binary searching over endow(idx).
+	size_t first_idx_with_endow_above(int64_t amount) const;
+
+	//! Index of the first entry (after the sentinel) whose cumulative
+	//! endowment is at least \a amount (size() if there is none).
+	size_t first_idx_with_endow_at_least(int64_t amount) const;
+
+	//! Total endowment (and endowment times price) of offers with
+	//! minPrice at most \a p.
+	EndowAccumulator lookup(Price p) const;
+
+	//! Same as lookup(), except that if \a p is exactly the highest
+	//! price level, that level is left out.  This is what
+	//! Orderbook::get_metadata() has always returned, and clearing
+	//! (and its validation) depend on it.
+	EndowAccumulator lookup_excluding_top_level(Price p) const;
+};
+
+} /* speedex */
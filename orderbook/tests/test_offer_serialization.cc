@@ -0,0 +1,46 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "orderbook/typedefs.h"
+
+#include <xdrpp/marshal.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace speedex {
+
+TEST_CASE("offer serialization matches xdr", "[orderbook]")
+{
+	Offer offer;
+	offer.category.sellAsset = 0x01020304;
+	offer.category.buyAsset = 0xA0B0C0D0;
+	offer.category.type = OfferType::SELL;
+	offer.offerId = 0x1122334455667788;
+	offer.owner = 0xFFEEDDCCBBAA9988;
+	offer.amount = 0x0000000100000002;
+	offer.minPrice = 0x8000000000000001;
+
+	OfferWrapper wrapper(offer);
+
+	auto expect = xdr::xdr_to_opaque(offer);
+	REQUIRE(expect.size() == OfferWrapper::SERIALIZED_LEN);
+
+	SECTION("empty buffer")
+	{
+		std::vector<uint8_t> buf;
+		wrapper.copy_data(buf);
+		REQUIRE(buf == expect);
+	}
+
+	SECTION("appends to buffer")
+	{
+		std::vector<uint8_t> buf = {0xFF, 0xFE};
+		wrapper.copy_data(buf);
+
+		std::vector<uint8_t> prefixed = {0xFF, 0xFE};
+		prefixed.insert(prefixed.end(), expect.begin(), expect.end());
+		REQUIRE(buf == prefixed);
+	}
+}
+
+} /* speedex */
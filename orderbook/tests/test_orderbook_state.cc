@@ -0,0 +1,447 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "memory_database/memory_database.h"
+
+#include "modlog/account_modification_log.h"
+
+#include "orderbook/offer_clearing_params.h"
+#include "orderbook/orderbook.h"
+#include "orderbook/orderbook_manager.h"
+#include "orderbook/orderbook_manager_view.h"
+
+#include "stats/block_update_stats.h"
+
+#include "utils/manage_data_dirs.h"
+#include "utils/price.h"
+
+#include "xdr/block.h"
+#include "xdr/types.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+namespace speedex {
+
+using xdr::operator==;
+
+namespace {
+
+constexpr uint16_t NUM_ASSETS = 2;
+constexpr uint64_t NUM_ACCOUNTS = 100;
+
+OfferCategory
+make_category() {
+	OfferCategory category;
+	category.sellAsset = 0;
+	category.buyAsset = 1;
+	category.type = OfferType::SELL;
+	return category;
+}
+
+void
+init_accounts(MemoryDatabase& db) {
+	MemoryDatabaseGenesisData data;
+	for (AccountID i = 0; i < NUM_ACCOUNTS; i++) {
+		data.id_list.push_back(i);
+	}
+	data.pk_list.resize(data.id_list.size());
+
+	db.install_initial_accounts_and_commit(data, [] (UserAccount& user) {
+		user.commit();
+	});
+}
+
+//! Random offers selling asset 0 for asset 1, all with minPrice
+//! below 1 (so that they trade at equal prices).
+std::vector<Offer>
+make_random_offers(size_t num_offers, std::minstd_rand& gen, uint64_t first_offer_id = 1) {
+	std::uniform_int_distribution<AccountID> owner_dist(0, NUM_ACCOUNTS - 1);
+	std::uniform_int_distribution<uint64_t> amount_dist(1, 1000);
+	std::uniform_int_distribution<int> price_dist(1, 99);
+
+	std::vector<Offer> out;
+	for (size_t i = 0; i < num_offers; i++) {
+		Offer offer;
+		offer.category = make_category();
+		offer.offerId = first_offer_id + i;
+		offer.owner = owner_dist(gen);
+		offer.amount = amount_dist(gen);
+		offer.minPrice = price::from_double(price_dist(gen) / 100.0);
+		out.push_back(offer);
+	}
+	return out;
+}
+
+OrderbookTriePrefix
+get_key(const Offer& offer) {
+	OrderbookTriePrefix key;
+	generate_orderbook_trie_key(offer, key);
+	return key;
+}
+
+int64_t
+total_endow(const std::vector<Offer>& offers) {
+	int64_t out = 0;
+	for (auto const& offer : offers) {
+		out += offer.amount;
+	}
+	return out;
+}
+
+void
+add_offers(OrderbookManager& manager, const std::vector<Offer>& offers) {
+	int x = 0;
+	ProcessingSerialManager serial_manager(manager);
+	for (auto const& offer : offers) {
+		serial_manager.add_offer(manager.look_up_idx(offer.category), offer, x, x);
+	}
+	serial_manager.finish_merge();
+}
+
+//! Clear the offers of the (0, 1) orderbook at equal prices,
+//! activating \a activated units of supply.
+void
+clear_offers(OrderbookManager& manager,
+	MemoryDatabase& db,
+	AccountModificationLog& log,
+	int64_t activated,
+	OrderbookStateCommitment& commitment_out)
+{
+	auto params = ClearingParams::get_null_clearing(10, manager.get_num_orderbooks());
+	params.orderbook_params[manager.look_up_idx(make_category())].supply_activated
+		= FractionalAsset::from_integral(activated);
+
+	std::vector<Price> prices(NUM_ASSETS, price::from_double(1));
+	BlockStateUpdateStatsWrapper stats;
+	manager.clear_offers_for_production(params, prices.data(), db, log, commitment_out, stats);
+}
+
+//! Root hash of every orderbook (through the hash cache).
+std::vector<Hash>
+get_root_hashes(OrderbookManager& manager) {
+	OrderbookStateCommitment commitment;
+	commitment.resize(manager.get_num_orderbooks());
+	manager.hash(commitment);
+
+	std::vector<Hash> out;
+	for (auto const& c : commitment) {
+		out.push_back(c.rootHash);
+	}
+	return out;
+}
+
+//! Check every orderbook's cached root hash against a recomputed one
+//! (and fill the cache, so the next check covers what happens in
+//! between).
+void
+check_hash_cache(OrderbookManager& manager) {
+	auto cached = get_root_hashes(manager);
+	auto& orderbooks = manager.get_orderbooks();
+	for (size_t i = 0; i < orderbooks.size(); i++) {
+		Hash fresh;
+		orderbooks[i].hash_uncached(fresh);
+		REQUIRE(cached[i] == fresh);
+	}
+	REQUIRE(get_root_hashes(manager) == cached);
+}
+
+} /* anonymous namespace */
+
+TEST_CASE("parallel clearing matches serial clearing", "[orderbook]")
+{
+	std::minstd_rand gen(0);
+	auto offers = make_random_offers(3 * Orderbook::PARALLEL_CLEAR_THRESHOLD, gen);
+	const int64_t endow = total_endow(offers);
+
+	struct Result {
+		std::vector<int64_t> balances;
+		Hash modlog_hash;
+		OrderbookStateCommitment commitment;
+		size_t num_offers;
+	};
+
+	auto run = [&] (size_t parallel_clear_threshold, int64_t activated) {
+		MemoryDatabase db;
+		init_accounts(db);
+		AccountModificationLog log;
+
+		OrderbookManager manager(NUM_ASSETS);
+		int idx = manager.look_up_idx(make_category());
+		manager.get_orderbooks()[idx].set_parallel_clear_threshold(parallel_clear_threshold);
+
+		add_offers(manager, offers);
+		manager.commit_for_production(1);
+
+		Result out;
+		clear_offers(manager, db, log, activated, out.commitment);
+		manager.hash(out.commitment);
+		log.hash(out.modlog_hash, 1);
+		out.num_offers = manager.num_open_offers();
+
+		for (AccountID i = 0; i < NUM_ACCOUNTS; i++) {
+			UserAccount* account = db.lookup_user(i);
+			REQUIRE(account != nullptr);
+			for (AssetID asset = 0; asset < NUM_ASSETS; asset++) {
+				out.balances.push_back(db.lookup_available_balance(account, asset));
+			}
+		}
+		return out;
+	};
+
+	// with a partially executing offer, and with every offer clearing
+	for (int64_t activated : {endow * 3 / 4 + 1, endow}) {
+		auto serial = run(SIZE_MAX, activated);
+		auto parallel = run(Orderbook::PARALLEL_CLEAR_THRESHOLD, activated);
+
+		REQUIRE(serial.balances == parallel.balances);
+		REQUIRE(serial.modlog_hash == parallel.modlog_hash);
+		REQUIRE(serial.commitment == parallel.commitment);
+		REQUIRE(serial.num_offers == parallel.num_offers);
+	}
+}
+
+TEST_CASE("orderbook hash cache matches recomputed hash", "[orderbook]")
+{
+	test::speedex_dirs dirs;
+
+	std::minstd_rand gen(1);
+
+	MemoryDatabase db;
+	init_accounts(db);
+	AccountModificationLog log;
+	OrderbookStateCommitment commitment;
+
+	std::vector<Hash> block_1_hashes;
+
+	{
+		OrderbookManager manager(NUM_ASSETS);
+		manager.open_lmdb_env();
+		manager.create_lmdb();
+		const int idx = manager.look_up_idx(make_category());
+
+		// block 1
+		auto offers = make_random_offers(1000, gen);
+		add_offers(manager, offers);
+		manager.commit_for_production(1);
+		check_hash_cache(manager);
+
+		clear_offers(manager, db, log, total_endow(offers) / 4, commitment);
+		check_hash_cache(manager);
+		block_1_hashes = get_root_hashes(manager);
+
+		// block 2: new offers, cancellations, and clearing
+		add_offers(manager, make_random_offers(500, gen, offers.size() + 1));
+		for (size_t i = 0; i < offers.size(); i += 3) {
+			OrderbookTriePrefix key;
+			generate_orderbook_trie_key(offers[i], key);
+			manager.mark_for_deletion(idx, key);
+		}
+		manager.commit_for_production(2);
+		check_hash_cache(manager);
+		REQUIRE(get_root_hashes(manager) != block_1_hashes);
+
+		clear_offers(manager, db, log, 1000, commitment);
+		check_hash_cache(manager);
+
+		// undo block 2
+		manager.rollback_thunks(1);
+		check_hash_cache(manager);
+		REQUIRE(get_root_hashes(manager) == block_1_hashes);
+
+		manager.persist_lmdb(1);
+	}
+
+	OrderbookManager manager(NUM_ASSETS);
+	manager.open_lmdb_env();
+	manager.open_lmdb();
+	manager.load_lmdb_contents_to_memory();
+	check_hash_cache(manager);
+	REQUIRE(get_root_hashes(manager) == block_1_hashes);
+}
+
+TEST_CASE("reloading orderbooks from lmdb preserves root hashes", "[orderbook]")
+{
+	// one orderbook smaller than a load chunk, and one spanning several
+	for (size_t num_offers : {10, 50'000}) {
+		test::speedex_dirs dirs;
+
+		std::minstd_rand gen(num_offers);
+
+		MemoryDatabase db;
+		init_accounts(db);
+		AccountModificationLog log;
+		OrderbookStateCommitment commitment;
+
+		std::vector<Hash> hashes;
+		size_t num_open_offers;
+
+		{
+			OrderbookManager manager(NUM_ASSETS);
+			manager.open_lmdb_env();
+			manager.create_lmdb();
+
+			auto offers = make_random_offers(num_offers, gen);
+			add_offers(manager, offers);
+			manager.commit_for_production(1);
+			clear_offers(manager, db, log, total_endow(offers) / 10, commitment);
+
+			hashes = get_root_hashes(manager);
+			num_open_offers = manager.num_open_offers();
+
+			manager.persist_lmdb(1);
+		}
+
+		OrderbookManager manager(NUM_ASSETS);
+		manager.open_lmdb_env();
+		manager.open_lmdb();
+		manager.load_lmdb_contents_to_memory();
+
+		REQUIRE(manager.num_open_offers() == num_open_offers);
+		REQUIRE(get_root_hashes(manager) == hashes);
+	}
+}
+
+TEST_CASE("persisting several blocks at once keeps offers below a later cancellation", "[orderbook]")
+{
+	test::speedex_dirs dirs;
+
+	std::minstd_rand gen(4);
+
+	MemoryDatabase db;
+	init_accounts(db);
+	AccountModificationLog log;
+	OrderbookStateCommitment commitment;
+
+	auto offers = make_random_offers(1000, gen);
+	auto highest = *std::max_element(offers.begin(), offers.end(),
+		[] (const Offer& a, const Offer& b) {
+			return get_key(a) < get_key(b);
+		});
+
+	std::vector<Hash> hashes;
+	size_t num_open_offers;
+
+	{
+		OrderbookManager manager(NUM_ASSETS);
+		manager.open_lmdb_env();
+		manager.create_lmdb();
+		const int idx = manager.look_up_idx(make_category());
+
+		add_offers(manager, offers);
+		manager.commit_for_production(1);
+		clear_offers(manager, db, log, 10, commitment);
+
+		// block 2 cancels block 1's highest offer (which the small
+		// clearings never reach)
+		REQUIRE(manager.mark_for_deletion(idx, get_key(highest)));
+		manager.commit_for_production(2);
+		clear_offers(manager, db, log, 10, commitment);
+
+		hashes = get_root_hashes(manager);
+		num_open_offers = manager.num_open_offers();
+
+		// both blocks in one write transaction
+		manager.persist_lmdb(2);
+	}
+
+	OrderbookManager manager(NUM_ASSETS);
+	manager.open_lmdb_env();
+	manager.open_lmdb();
+	manager.load_lmdb_contents_to_memory();
+
+	REQUIRE(manager.num_open_offers() == num_open_offers);
+	REQUIRE(get_root_hashes(manager) == hashes);
+}
+
+TEST_CASE("production cancellations claim offers and mark them at commit", "[orderbook]")
+{
+	std::minstd_rand gen(3);
+	auto offers = make_random_offers(1000, gen);
+
+	OrderbookManager claimed(NUM_ASSETS);
+	OrderbookManager marked(NUM_ASSETS);
+	const int idx = claimed.look_up_idx(make_category());
+	for (auto* manager : {&claimed, &marked}) {
+		add_offers(*manager, offers);
+		manager->commit_for_production(1);
+	}
+
+	ProcessingSerialManager serial_manager(claimed);
+	auto cancel = [&] (const Offer& offer) {
+		return serial_manager.delete_offer(
+			idx, offer.minPrice, offer.owner, offer.offerId);
+	};
+	auto undo_cancel = [&] (const Offer& offer) {
+		serial_manager.undelete_offer(
+			idx, offer.minPrice, offer.owner, offer.offerId);
+	};
+
+	// offers are in random key order
+	for (size_t i = 0; i < offers.size(); i += 2) {
+		auto found = cancel(offers[i]);
+		REQUIRE(found);
+		REQUIRE(found->amount == offers[i].amount);
+		REQUIRE(!cancel(offers[i]));
+	}
+	// claims do not modify the trie before the commit
+	REQUIRE(claimed.num_open_offers() == offers.size());
+
+	// undoing a cancellation releases its claim
+	undo_cancel(offers[0]);
+	REQUIRE(cancel(offers[0]));
+	undo_cancel(offers[0]);
+
+	Offer missing = offers[1];
+	missing.offerId = offers.size() + 1;
+	REQUIRE(!cancel(missing));
+
+	for (size_t i = 2; i < offers.size(); i += 2) {
+		REQUIRE(marked.mark_for_deletion(idx, get_key(offers[i])));
+	}
+
+	claimed.commit_for_production(2);
+	marked.commit_for_production(2);
+	REQUIRE(claimed.num_open_offers() == offers.size() / 2 + 1);
+	REQUIRE(get_root_hashes(claimed) == get_root_hashes(marked));
+
+	// the commit consumed the claims
+	REQUIRE(!cancel(offers[2]));
+	REQUIRE(cancel(offers[0]));
+}
+
+TEST_CASE("rewinding orderbooks drops production cancellation claims", "[orderbook]")
+{
+	std::minstd_rand gen(4);
+	auto offers = make_random_offers(100, gen);
+
+	OrderbookManager manager(NUM_ASSETS);
+	const int idx = manager.look_up_idx(make_category());
+	add_offers(manager, offers);
+	manager.commit_for_production(1);
+	auto hashes = get_root_hashes(manager);
+
+	ProcessingSerialManager serial_manager(manager);
+	auto cancel = [&] (const Offer& offer) {
+		return serial_manager.delete_offer(
+			idx, offer.minPrice, offer.owner, offer.offerId);
+	};
+
+	for (auto const& offer : offers) {
+		REQUIRE(cancel(offer));
+	}
+	// abandon block 2, as when rewinding to the committed height
+	manager.rollback_thunks(1);
+
+	// the abandoned block's cancellations neither stay claimed
+	// nor delete offers at the next commit
+	REQUIRE(cancel(offers[0]));
+	serial_manager.undelete_offer(idx, offers[0].minPrice, offers[0].owner, offers[0].offerId);
+
+	manager.commit_for_production(2);
+	REQUIRE(manager.num_open_offers() == offers.size());
+	REQUIRE(get_root_hashes(manager) == hashes);
+}
+
+} /* speedex */
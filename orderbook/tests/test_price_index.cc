@@ -0,0 +1,602 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "orderbook/depth_snapshot.h"
+#include "orderbook/price_index.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <random>
+#include <vector>
+
+namespace speedex {
+
+namespace {
+
+//! Reference implementation: cumulative metadata of all levels
+//! with key at most p.
+EndowAccumulator
+linear_lookup(const std::vector<Price>& keys, const std::vector<int64_t>& endows, Price p) {
+	EndowAccumulator out;
+	for (size_t i = 0; i < keys.size(); i++) {
+		if (keys[i] <= p) {
+			out.endow += endows[i];
+			out.endow_times_price += ((__int128) endows[i]) * keys[i];
+		}
+	}
+	return out;
+}
+
+//! The binary search that Orderbook::get_metadata() used to run
+//! over (key, cumulative metadata) entries, entry 0 a sentinel.
+EndowAccumulator
+original_get_metadata(const std::vector<Price>& keys, const std::vector<EndowAccumulator>& cumulative, Price p) {
+	int start = 1;
+	int end = keys.size() - 1;
+	if (end <= 0) {
+		return EndowAccumulator{};
+	}
+	if (p > keys[end]) {
+		return cumulative[end];
+	}
+	int mp = (end + start) / 2;
+	while (true) {
+		if (end == start) {
+			return cumulative[end - 1];
+		}
+		if (p >= keys[mp]) {
+			start = mp + 1;
+		} else {
+			end = mp;
+		}
+		mp = (end + start) / 2;
+	}
+}
+
+void
+build_index(OrderbookPriceIndex& index, const std::vector<Price>& keys, const std::vector<int64_t>& endows) {
+	index.clear();
+	index.reserve(keys.size());
+	EndowAccumulator acc;
+	for (size_t i = 0; i < keys.size(); i++) {
+		acc.endow += endows[i];
+		acc.endow_times_price += ((__int128) endows[i]) * keys[i];
+		index.append_level(keys[i], acc);
+	}
+	index.finalize();
+}
+
+void
+build_index(OrderbookPriceIndex& index, const std::map<Price, int64_t>& levels) {
+	std::vector<Price> keys;
+	std::vector<int64_t> endows;
+	for (auto [key, endow] : levels) {
+		keys.push_back(key);
+		endows.push_back(endow);
+	}
+	build_index(index, keys, endows);
+}
+
+void
+check_same_index(const OrderbookPriceIndex& index, const OrderbookPriceIndex& expect) {
+	REQUIRE(index.size() == expect.size());
+	for (size_t i = 0; i < expect.size(); i++) {
+		REQUIRE(index.key(i) == expect.key(i));
+		REQUIRE(index.metadata(i).endow == expect.metadata(i).endow);
+		REQUIRE(index.metadata(i).endow_times_price == expect.metadata(i).endow_times_price);
+		REQUIRE(index.upper_bound_idx(expect.key(i)) == i);
+	}
+}
+
+} /* anonymous namespace */
+
+TEST_CASE("empty price index", "[orderbook]")
+{
+	OrderbookPriceIndex index;
+
+	REQUIRE(index.size() == 1);
+	REQUIRE(index.lookup(0).endow == 0);
+	REQUIRE(index.lookup(UINT64_MAX).endow == 0);
+
+	index.clear();
+	index.finalize();
+	REQUIRE(index.upper_bound_idx(100) == 0);
+}
+
+TEST_CASE("price index boundaries", "[orderbook]")
+{
+	OrderbookPriceIndex index;
+
+	std::vector<Price> keys = {10, 20, 30};
+	std::vector<int64_t> endows = {1, 2, 4};
+
+	build_index(index, keys, endows);
+
+	REQUIRE(index.size() == 4);
+
+	REQUIRE(index.upper_bound_idx(0) == 0);
+	REQUIRE(index.upper_bound_idx(9) == 0);
+	REQUIRE(index.upper_bound_idx(10) == 1);
+	REQUIRE(index.upper_bound_idx(19) == 1);
+	REQUIRE(index.upper_bound_idx(20) == 2);
+	// an exact match on the highest level includes that level
+	REQUIRE(index.upper_bound_idx(30) == 3);
+	REQUIRE(index.upper_bound_idx(UINT64_MAX) == 3);
+
+	REQUIRE(index.lookup(20).endow == 3);
+	REQUIRE(index.lookup(30).endow == 7);
+	REQUIRE(index.lookup(30).endow_times_price == 10 + 40 + 120);
+}
+
+TEST_CASE("price index matches linear scan", "[orderbook]")
+{
+	std::minstd_rand gen(0);
+	std::uniform_int_distribution<Price> gap_dist(1, 1000);
+	std::uniform_int_distribution<int64_t> endow_dist(1, 1'000'000);
+
+	OrderbookPriceIndex index;
+
+	// cover complete and partial trees of several depths
+	for (size_t n : {1, 2, 3, 7, 8, 9, 100, 1023, 1024, 1025}) {
+		std::vector<Price> keys;
+		std::vector<int64_t> endows;
+		Price key = 0;
+		for (size_t i = 0; i < n; i++) {
+			key += gap_dist(gen);
+			keys.push_back(key);
+			endows.push_back(endow_dist(gen));
+		}
+
+		build_index(index, keys, endows);
+		REQUIRE(index.size() == n + 1);
+
+		for (Price p = 0; p <= key + 1; p += (gap_dist(gen) / 3) + 1) {
+			auto expect = linear_lookup(keys, endows, p);
+			auto res = index.lookup(p);
+			REQUIRE(res.endow == expect.endow);
+			REQUIRE(res.endow_times_price == expect.endow_times_price);
+		}
+		for (Price p : keys) {
+			auto expect = linear_lookup(keys, endows, p);
+			REQUIRE(index.lookup(p).endow == expect.endow);
+			REQUIRE(index.lookup(p - 1).endow == linear_lookup(keys, endows, p - 1).endow);
+		}
+	}
+}
+
+TEST_CASE("price index lookup excluding top level matches the original search", "[orderbook]")
+{
+	std::minstd_rand gen(5);
+	std::uniform_int_distribution<Price> gap_dist(1, 1000);
+	std::uniform_int_distribution<int64_t> endow_dist(1, 1'000'000);
+
+	OrderbookPriceIndex index;
+
+	for (size_t n : {0, 1, 2, 3, 100, 1000}) {
+		std::vector<Price> keys;
+		std::vector<int64_t> endows;
+		std::vector<Price> sentinel_keys = {0};
+		std::vector<EndowAccumulator> cumulative = {EndowAccumulator{}};
+		Price key = 0;
+		for (size_t i = 0; i < n; i++) {
+			key += gap_dist(gen);
+			keys.push_back(key);
+			endows.push_back(endow_dist(gen));
+
+			EndowAccumulator acc = cumulative.back();
+			acc.endow += endows.back();
+			acc.endow_times_price += ((__int128) endows.back()) * key;
+			sentinel_keys.push_back(key);
+			cumulative.push_back(acc);
+		}
+
+		build_index(index, keys, endows);
+
+		auto check = [&] (Price p) {
+			auto expect = original_get_metadata(sentinel_keys, cumulative, p);
+			auto res = index.lookup_excluding_top_level(p);
+			REQUIRE(res.endow == expect.endow);
+			REQUIRE(res.endow_times_price == expect.endow_times_price);
+		};
+
+		check(0);
+		check(UINT64_MAX);
+		for (Price p : keys) {
+			check(p - 1);
+			check(p);
+			check(p + 1);
+		}
+	}
+}
+
+TEST_CASE("price index endowment searches match linear scan", "[orderbook]")
+{
+	std::minstd_rand gen(7);
+	std::uniform_int_distribution<Price> gap_dist(1, 1000);
+	std::uniform_int_distribution<int64_t> endow_dist(1, 1000);
+
+	OrderbookPriceIndex index;
+
+	for (size_t n : {0, 1, 2, 95, 96, 97, 1000, 5000}) {
+		std::vector<Price> keys;
+		std::vector<int64_t> endows;
+		Price key = 0;
+		for (size_t i = 0; i < n; i++) {
+			key += gap_dist(gen);
+			keys.push_back(key);
+			endows.push_back(endow_dist(gen));
+		}
+
+		build_index(index, keys, endows);
+
+		auto check = [&] (int64_t amount) {
+			size_t above = 1, at_least = 1;
+			while (above < index.size() && index.endow(above) <= amount) {
+				above++;
+			}
+			while (at_least < index.size() && index.endow(at_least) < amount) {
+				at_least++;
+			}
+			REQUIRE(index.first_idx_with_endow_above(amount) == above);
+			REQUIRE(index.first_idx_with_endow_at_least(amount) == at_least);
+		};
+
+		check(-1);
+		check(0);
+		for (size_t i = 1; i < index.size(); i++) {
+			check(index.endow(i) - 1);
+			check(index.endow(i));
+			check(index.endow(i) + 1);
+		}
+	}
+}
+
+TEST_CASE("patched price index matches rebuild", "[orderbook]")
+{
+	std::minstd_rand gen(0);
+	std::uniform_int_distribution<Price> price_dist(1, 10'000'000);
+	std::uniform_int_distribution<int64_t> endow_dist(1, 1'000'000);
+
+	// large enough to patch in several chunks
+	for (size_t n : {0, 1, 10, 1000, 100'000}) {
+		std::map<Price, int64_t> levels;
+		while (levels.size() < n) {
+			levels[price_dist(gen)] += endow_dist(gen);
+		}
+
+		OrderbookPriceIndex index, expect;
+		build_index(index, levels);
+
+		for (int round = 0; round < 3; round++) {
+			PriceIndexChangeLog log;
+			log.reset();
+
+			// clear everything below (and part of) some level
+			if (levels.size() > 0) {
+				auto it = levels.begin();
+				std::advance(it, gen() % levels.size());
+				int64_t removed = std::uniform_int_distribution<int64_t>(0, it->second)(gen);
+				it->second -= removed;
+				for (auto below = levels.begin(); below != it; below++) {
+					removed += below->second;
+				}
+				log.log_clearing(it->first, removed);
+				levels.erase(levels.begin(), it);
+				if (it->second == 0) {
+					levels.erase(it);
+				}
+			}
+
+			for (size_t i = 0; i < n / 10 + 5; i++) {
+				if (gen() % 2 == 0 && levels.size() > 0) {
+					// delete (part of) an existing level
+					auto it = levels.lower_bound(price_dist(gen));
+					if (it == levels.end()) {
+						it = levels.begin();
+					}
+					int64_t amount = std::uniform_int_distribution<int64_t>(1, it->second)(gen);
+					log.log_offer_change(it->first, -amount);
+					it->second -= amount;
+					if (it->second == 0) {
+						levels.erase(it);
+					}
+				} else {
+					Price p = price_dist(gen);
+					int64_t amount = endow_dist(gen);
+					log.log_offer_change(p, amount);
+					levels[p] += amount;
+				}
+			}
+
+			REQUIRE(index.apply_changes(log));
+			build_index(expect, levels);
+			check_same_index(index, expect);
+		}
+	}
+}
+
+TEST_CASE("persistent price index over many blocks", "[orderbook]")
+{
+	std::minstd_rand gen(1);
+	std::uniform_int_distribution<Price> price_dist(1, 1'000'000);
+	std::uniform_int_distribution<int64_t> endow_dist(1, 1000);
+
+	std::map<Price, int64_t> levels;
+	while (levels.size() < 20'000) {
+		levels[price_dist(gen)] += endow_dist(gen);
+	}
+
+	OrderbookPriceIndex index, expect;
+	build_index(index, levels);
+
+	// few enough changes per round to be applied one at a time
+	for (int round = 0; round < 50; round++) {
+		PriceIndexChangeLog log;
+		log.reset();
+
+		// clear a few levels
+		auto it = levels.begin();
+		std::advance(it, gen() % 5);
+		int64_t removed = it->second / 2;
+		it->second -= removed;
+		for (auto below = levels.begin(); below != it; below++) {
+			removed += below->second;
+		}
+		log.log_clearing(it->first, removed);
+		levels.erase(levels.begin(), it);
+
+		for (int i = 0; i < 300; i++) {
+			if (gen() % 3 == 0) {
+				// remove a level entirely
+				auto del = levels.lower_bound(price_dist(gen));
+				if (del == levels.end()) {
+					continue;
+				}
+				log.log_offer_change(del->first, -del->second);
+				levels.erase(del);
+			} else {
+				// clustered inserts, to split blocks
+				Price p = (round % 2 == 0) ? price_dist(gen) : 500'000 + gen() % 1000;
+				int64_t amount = endow_dist(gen);
+				log.log_offer_change(p, amount);
+				levels[p] += amount;
+			}
+		}
+
+		REQUIRE(index.apply_changes(log));
+		build_index(expect, levels);
+		check_same_index(index, expect);
+
+		for (int i = 0; i < 100; i++) {
+			Price p = price_dist(gen);
+			REQUIRE(index.lookup(p).endow == expect.lookup(p).endow);
+			REQUIRE(index.lookup(p).endow_times_price == expect.lookup(p).endow_times_price);
+		}
+	}
+}
+
+TEST_CASE("small price index blocks grow before splitting", "[orderbook]")
+{
+	std::minstd_rand gen(6);
+	std::uniform_int_distribution<Price> price_dist(1, 1'000'000);
+	std::uniform_int_distribution<int64_t> endow_dist(1, 1000);
+
+	// one block, allocated for 20 levels
+	std::map<Price, int64_t> levels;
+	while (levels.size() < 20) {
+		levels[price_dist(gen)] += endow_dist(gen);
+	}
+
+	OrderbookPriceIndex index, expect;
+	build_index(index, levels);
+
+	// one insert at a time, so each is applied incrementally
+	while (levels.size() < 400) {
+		PriceIndexChangeLog log;
+		log.reset();
+		Price p = price_dist(gen);
+		int64_t amount = endow_dist(gen);
+		log.log_offer_change(p, amount);
+		levels[p] += amount;
+
+		REQUIRE(index.apply_changes(log));
+		build_index(expect, levels);
+		check_same_index(index, expect);
+	}
+}
+
+TEST_CASE("price index matches map model under single changes", "[orderbook]")
+{
+	std::minstd_rand gen(4);
+	std::uniform_int_distribution<Price> price_dist(1, 1'000'000);
+	std::uniform_int_distribution<int64_t> endow_dist(1, 1000);
+
+	std::map<Price, int64_t> levels;
+	while (levels.size() < 1000) {
+		levels[price_dist(gen)] += endow_dist(gen);
+	}
+	OrderbookPriceIndex index;
+	build_index(index, levels);
+
+	// Compare lookup() against the model at every level,
+	// just below every level, and at some random prices.
+	auto check_lookups = [&] () {
+		REQUIRE(index.size() == levels.size() + 1);
+
+		std::vector<Price> keys;
+		std::vector<EndowAccumulator> cumulative;
+		EndowAccumulator acc;
+		for (auto [key, endow] : levels) {
+			acc.endow += endow;
+			acc.endow_times_price += ((__int128) endow) * key;
+			keys.push_back(key);
+			cumulative.push_back(acc);
+		}
+		auto expect_lookup = [&] (Price p) {
+			size_t n = std::upper_bound(keys.begin(), keys.end(), p) - keys.begin();
+			return (n == 0) ? EndowAccumulator{} : cumulative[n - 1];
+		};
+		auto check_at = [&] (Price p) {
+			auto expect = expect_lookup(p);
+			auto res = index.lookup(p);
+			REQUIRE(res.endow == expect.endow);
+			REQUIRE(res.endow_times_price == expect.endow_times_price);
+		};
+
+		for (Price p : keys) {
+			check_at(p);
+			check_at(p - 1);
+		}
+		for (int i = 0; i < 10; i++) {
+			check_at(price_dist(gen));
+		}
+		check_at(UINT64_MAX);
+	};
+
+	auto apply = [&] (PriceIndexChangeLog& log) {
+		REQUIRE(index.apply_changes(log));
+		check_lookups();
+	};
+
+	// Alternate between growing the book (inserts clustered in a
+	// narrow range, to split blocks) and shrinking it (deletions,
+	// which erase emptied blocks and eventually rebalance the index
+	// with merge_changes({})), with clearings throughout.
+	bool growing = true;
+	for (int step = 0; step < 6000; step++) {
+		if (levels.size() >= 2000) {
+			growing = false;
+		} else if (levels.size() <= 200) {
+			growing = true;
+		}
+		const uint32_t insert_pct = growing ? 80 : 10;
+
+		PriceIndexChangeLog log;
+		log.reset();
+
+		const uint32_t op = gen() % 100;
+		if (op < 2 && levels.size() > 0) {
+			// clear below (and part of) one of the lowest levels
+			auto it = levels.begin();
+			std::advance(it, gen() % std::min<size_t>(levels.size(), 5));
+			int64_t removed = (gen() % 2 == 0)
+				? it->second
+				: std::uniform_int_distribution<int64_t>(0, it->second)(gen);
+			it->second -= removed;
+			for (auto below = levels.begin(); below != it; below++) {
+				removed += below->second;
+			}
+			log.log_clearing(it->first, removed);
+			levels.erase(levels.begin(), it);
+			if (it->second == 0) {
+				levels.erase(it);
+			}
+		} else if (step == 5000) {
+			levels.clear();
+			log.log_clear_all();
+		} else if (op < insert_pct || levels.empty()) {
+			Price p = (gen() % 2 == 0) ? price_dist(gen) : 500'000 + gen() % 5000;
+			int64_t amount = endow_dist(gen);
+			log.log_offer_change(p, amount);
+			levels[p] += amount;
+		} else {
+			auto it = levels.lower_bound(price_dist(gen));
+			if (it == levels.end()) {
+				it = levels.begin();
+			}
+			// usually remove the whole level
+			int64_t amount = (gen() % 4 == 0)
+				? std::uniform_int_distribution<int64_t>(1, it->second)(gen)
+				: it->second;
+			log.log_offer_change(it->first, -amount);
+			it->second -= amount;
+			if (it->second == 0) {
+				levels.erase(it);
+			}
+		}
+
+		apply(log);
+	}
+}
+
+TEST_CASE("price index rejects inconsistent changes", "[orderbook]")
+{
+	OrderbookPriceIndex index;
+	build_index(index, {10, 20, 30}, {1, 2, 4});
+
+	PriceIndexChangeLog log;
+	REQUIRE(!index.apply_changes(log));
+
+	log.reset();
+	log.log_clearing(15, 1);
+	REQUIRE(!index.apply_changes(log));
+
+	build_index(index, {10, 20, 30}, {1, 2, 4});
+	log.reset();
+	log.log_offer_change(20, -3);
+	REQUIRE(!index.apply_changes(log));
+
+	log.reset();
+	log.log_clear_all();
+	log.log_offer_change(25, 5);
+	REQUIRE(index.apply_changes(log));
+	REQUIRE(index.size() == 2);
+	REQUIRE(index.lookup(30).endow == 5);
+}
+
+TEST_CASE("depth snapshot matches price index", "[orderbook]")
+{
+	std::minstd_rand gen(3);
+	std::uniform_int_distribution<Price> price_dist(1, 100000);
+	std::uniform_int_distribution<int64_t> endow_dist(1, 1000);
+
+	std::map<Price, int64_t> levels;
+	for (int i = 0; i < 1000; i++) {
+		levels[price_dist(gen)] += endow_dist(gen);
+	}
+
+	OrderbookPriceIndex index;
+	build_index(index, levels);
+
+	OrderbookDepthSnapshot snapshot(index, 7);
+	REQUIRE(snapshot.get_block_number() == 7);
+	REQUIRE(snapshot.num_price_levels() == levels.size());
+	REQUIRE(snapshot.total_endow() == index.metadata(index.size() - 1).endow);
+
+	for (size_t i = 0; i < snapshot.num_price_levels(); i++) {
+		REQUIRE(snapshot.level_price(i) == index.key(i + 1));
+		REQUIRE(snapshot.level_cumulative(i).endow == index.endow(i + 1));
+	}
+
+	REQUIRE(snapshot.endow_at(0) == 0);
+	for (int i = 0; i < 1000; i++) {
+		Price p = price_dist(gen);
+		REQUIRE(snapshot.depth_at(p).endow == index.lookup(p).endow);
+		REQUIRE(snapshot.depth_at(p).endow_times_price == index.lookup(p).endow_times_price);
+	}
+
+	// Later changes to the index (which modify, split, truncate and
+	// drop the blocks the snapshot shares) do not affect the snapshot.
+	OrderbookPriceIndex expect;
+	build_index(expect, levels);
+
+	for (int round = 0; round < 20; round++) {
+		PriceIndexChangeLog log;
+		log.reset();
+		log.log_clearing(index.key(1), index.endow(1));
+		for (int i = 0; i < 30; i++) {
+			log.log_offer_change(50'000 + gen() % 100, endow_dist(gen));
+		}
+		REQUIRE(index.apply_changes(log));
+	}
+	REQUIRE(index.size() != expect.size());
+
+	REQUIRE(snapshot.num_price_levels() == expect.size() - 1);
+	for (size_t i = 0; i < snapshot.num_price_levels(); i++) {
+		REQUIRE(snapshot.level_price(i) == expect.key(i + 1));
+		REQUIRE(snapshot.level_cumulative(i).endow == expect.endow(i + 1));
+	}
+	REQUIRE(snapshot.total_endow() == expect.metadata(expect.size() - 1).endow);
+}
+
+} /* speedex */
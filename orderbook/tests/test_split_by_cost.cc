@@ -0,0 +1,139 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "orderbook/utils.h"
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+namespace speedex {
+
+namespace {
+
+std::vector<size_t>
+split(const std::vector<size_t>& costs, size_t num_parts) {
+	std::vector<size_t> bounds(num_parts + 1, SIZE_MAX);
+	split_by_cost(
+		0, 
+		costs.size(), 
+		num_parts, 
+		[&costs] (size_t i) { return costs[i]; },
+		bounds.begin());
+	return bounds;
+}
+
+//! Bounds are a nondecreasing cover of [0, num_items).
+void
+check_cover(const std::vector<size_t>& bounds, size_t num_items) {
+	REQUIRE(bounds.front() == 0);
+	REQUIRE(bounds.back() == num_items);
+	for (size_t i = 0; i + 1 < bounds.size(); i++) {
+		REQUIRE(bounds[i] <= bounds[i+1]);
+	}
+}
+
+} /* anonymous namespace */
+
+TEST_CASE("split by cost even", "[split_by_cost]")
+{
+	std::vector<size_t> costs(12, 5);
+	auto bounds = split(costs, 4);
+	REQUIRE(bounds == std::vector<size_t>{0, 3, 6, 9, 12});
+}
+
+TEST_CASE("split by cost skewed", "[split_by_cost]")
+{
+	SECTION("one heavy item first")
+	{
+		std::vector<size_t> costs = {100, 1, 1, 1};
+		auto bounds = split(costs, 2);
+		REQUIRE(bounds == std::vector<size_t>{0, 1, 4});
+	}
+
+	SECTION("one heavy item in the middle")
+	{
+		std::vector<size_t> costs = {1, 1, 100, 1, 1};
+		auto bounds = split(costs, 3);
+		// the heavy item ends the first part, and covers the
+		// second part's share too
+		REQUIRE(bounds == std::vector<size_t>{0, 3, 3, 5});
+	}
+
+	SECTION("random skewed costs")
+	{
+		std::minstd_rand gen(1);
+		std::uniform_int_distribution<size_t> exp_dist(0, 16);
+
+		for (size_t trial = 0; trial < 100; trial++) {
+			std::vector<size_t> costs(1 + trial * 3);
+			size_t total = 0, max_cost = 0;
+			for (auto& cost : costs) {
+				cost = size_t(1) << exp_dist(gen);
+				total += cost;
+				max_cost = std::max(max_cost, cost);
+			}
+
+			const size_t num_parts = 1 + trial % 9;
+			auto bounds = split(costs, num_parts);
+			check_cover(bounds, costs.size());
+
+			// no part exceeds an even share by more than one item
+			for (size_t p = 0; p < num_parts; p++) {
+				size_t part_cost = 0;
+				for (size_t i = bounds[p]; i < bounds[p+1]; i++) {
+					part_cost += costs[i];
+				}
+				REQUIRE(part_cost * num_parts <= total + max_cost * num_parts);
+			}
+		}
+	}
+}
+
+TEST_CASE("split by cost zero total", "[split_by_cost]")
+{
+	std::vector<size_t> costs(10, 0);
+	auto bounds = split(costs, 4);
+	REQUIRE(bounds == std::vector<size_t>{0, 2, 5, 7, 10});
+}
+
+TEST_CASE("split by cost more parts than items", "[split_by_cost]")
+{
+	SECTION("nonzero costs")
+	{
+		std::vector<size_t> costs = {3, 1};
+		auto bounds = split(costs, 5);
+		check_cover(bounds, costs.size());
+		size_t nonempty = 0;
+		for (size_t p = 0; p < 5; p++) {
+			if (bounds[p] != bounds[p+1]) {
+				nonempty++;
+				REQUIRE(bounds[p+1] == bounds[p] + 1);
+			}
+		}
+		REQUIRE(nonempty == 2);
+	}
+
+	SECTION("zero costs")
+	{
+		std::vector<size_t> costs = {0, 0};
+		auto bounds = split(costs, 5);
+		check_cover(bounds, costs.size());
+	}
+
+	SECTION("no items")
+	{
+		std::vector<size_t> costs;
+		auto bounds = split(costs, 3);
+		REQUIRE(bounds == std::vector<size_t>{0, 0, 0, 0});
+	}
+}
+
+TEST_CASE("split by cost subrange", "[split_by_cost]")
+{
+	std::vector<size_t> costs = {9, 9, 1, 1, 1, 1, 9, 9};
+	std::vector<size_t> bounds(3);
+	split_by_cost(2, 6, 2, [&costs] (size_t i) { return costs[i]; }, bounds.begin());
+	REQUIRE(bounds == std::vector<size_t>{2, 4, 6});
+}
+
+} /* speedex */
@@ -37,17 +37,46 @@
 
 namespace speedex {
 
-struct OrderbookMethods
+/*! Offer stored in an orderbook trie.
+
+Serializes (for hashing) to the XDR encoding of the offer,
+but writes it directly into the caller's buffer,
+instead of allocating a temporary buffer per offer.
+*/
+struct OfferWrapper : public Offer
 {
-	// warning police: sidesteps anonymous namespace warnings -Wsubobject-linkage
-	static std::vector<uint8_t> 
-	serialize(const Offer& v)
+	//! Length of the XDR encoding of an Offer.
+	constexpr static size_t SERIALIZED_LEN
+		= 3 * sizeof(uint32_t) + 4 * sizeof(uint64_t);
+
+	OfferWrapper() : Offer() {}
+	OfferWrapper(const Offer& offer) : Offer(offer) {}
+
+	//! Write the XDR encoding of the offer to buf[0..SERIALIZED_LEN).
+	void serialize_to(uint8_t* buf) const
 	{
-		return xdr::xdr_to_opaque(v);
+		auto write = [&buf] <typename T> (T value) {
+			for (size_t i = 0; i < sizeof(T); i++) {
+				buf[i] = static_cast<uint8_t>(value >> (8 * (sizeof(T) - 1 - i)));
+			}
+			buf += sizeof(T);
+		};
+		write(static_cast<uint32_t>(category.sellAsset));
+		write(static_cast<uint32_t>(category.buyAsset));
+		write(static_cast<uint32_t>(category.type));
+		write(static_cast<uint64_t>(offerId));
+		write(static_cast<uint64_t>(owner));
+		write(static_cast<uint64_t>(amount));
+		write(static_cast<uint64_t>(minPrice));
 	}
-};
 
-typedef trie::XdrTypeWrapper<Offer, &OrderbookMethods::serialize> OfferWrapper;
+	void copy_data(std::vector<uint8_t>& buf) const
+	{
+		size_t offset = buf.size();
+		buf.resize(offset + SERIALIZED_LEN);
+		serialize_to(buf.data() + offset);
+	}
+};
 
 constexpr static size_t ORDERBOOK_KEY_LEN 
 	= price::PRICE_BYTES + sizeof(AccountID) + sizeof(uint64_t);
@@ -23,6 +23,8 @@
 Miscellaneous utility functions for working with orderbooks.
 */
 
+#include <cstddef>
+
 #include "xdr/types.h"
 
 namespace speedex {
@@ -110,5 +112,50 @@ get_num_orderbooks_by_asset_count(unsigned int asset_count) {
 	return NUM_OFFER_TYPES * (asset_count * (asset_count - 1));
 }
 
+/*! Split items [start, end) into num_parts contiguous ranges of
+roughly equal total cost.  Part p is [bounds_out[p], bounds_out[p+1]),
+so bounds_out needs num_parts + 1 entries.
+
+Part p ends at the first item where the cumulative cost reaches
+p/num_parts of the total.  A single item can cost more than one part's
+share, so some parts may be empty.  If every item costs 0, items are
+split evenly by count instead.
+*/
+template<typename CostFn, typename OutputIt>
+void
+split_by_cost(
+	size_t start, size_t end, size_t num_parts, CostFn&& cost, OutputIt bounds_out)
+{
+	if (num_parts == 0) {
+		throw std::runtime_error("split_by_cost needs at least one part");
+	}
+
+	size_t total_cost = 0;
+	for (size_t i = start; i < end; i++) {
+		total_cost += cost(i);
+	}
+
+	bounds_out[0] = start;
+	if (total_cost == 0) {
+		for (size_t part = 1; part <= num_parts; part++) {
+			bounds_out[part] = start + ((end - start) * part) / num_parts;
+		}
+		return;
+	}
+
+	size_t part = 1;
+	size_t acc_cost = 0;
+	for (size_t i = start; i < end && part < num_parts; i++) {
+		acc_cost += cost(i);
+		while (part < num_parts && acc_cost * num_parts >= total_cost * part) {
+			bounds_out[part] = i + 1;
+			part++;
+		}
+	}
+	for (; part <= num_parts; part++) {
+		bounds_out[part] = end;
+	}
+}
+
 
 } /* speedex */
\ No newline at end of file
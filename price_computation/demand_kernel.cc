@@ -0,0 +1,397 @@
+/**
+ * SPEEDEX: A Scalable, Parallelizable, and Economically Efficient Decentralized Exchange
+ * Copyright (C) 2023 Geoffrey Ramseyer
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "price_computation/demand_kernel.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace speedex {
+
+[[noreturn]] static void
+throw_metadata_error()
+{
+	throw std::runtime_error(
+		"This should absolutely never happen, and means the price index "
+		"is broken (or maybe an overflow)");
+}
+
+bool
+DemandKernel::load_book(
+	size_t lane,
+	const Orderbook& orderbook,
+	const Price* prices,
+	const uint8_t smooth_mult)
+{
+	auto category = orderbook.get_category();
+
+	sell_assets[lane] = category.sellAsset;
+	buy_assets[lane] = category.buyAsset;
+	sell_prices[lane] = prices[category.sellAsset];
+	buy_prices[lane] = prices[category.buyAsset];
+
+	auto [full_exec_p, partial_exec_p]
+		= orderbook.get_execution_prices(sell_prices[lane], buy_prices[lane], smooth_mult);
+
+	auto metadata_partial = orderbook.get_metadata(partial_exec_p);
+	auto metadata_full = metadata_partial;
+	if (smooth_mult) {
+		metadata_full = orderbook.get_metadata(full_exec_p);
+	}
+
+	full_exec_endows[lane] = metadata_full.endow;
+	partial_exec_endows[lane] = metadata_partial.endow - metadata_full.endow;
+	partial_exec_endow_times_prices[lane]
+		= metadata_partial.endow_times_price - metadata_full.endow_times_price;
+
+	return metadata_full.endow_times_price > metadata_partial.endow_times_price;
+}
+
+bool
+DemandKernel::load_batch(
+	const Price* prices,
+	const std::vector<Orderbook>& work_units,
+	size_t start,
+	size_t count,
+	const uint8_t smooth_mult)
+{
+	bool metadata_error = false;
+
+	for (size_t i = 0; i < count; i++) {
+		metadata_error |= load_book(i, work_units[start + i], prices, smooth_mult);
+	}
+	return metadata_error;
+}
+
+bool
+DemandKernel::compute_batch(size_t count, const uint8_t smooth_mult)
+{
+	bool arith_error = false;
+
+	for (size_t i = 0; i < count; i++) {
+		volumes[i] = Orderbook::trade_volume_times_prices(
+			sell_prices[i],
+			buy_prices[i],
+			smooth_mult,
+			full_exec_endows[i],
+			partial_exec_endows[i],
+			partial_exec_endow_times_prices[i],
+			arith_error);
+	}
+	return arith_error;
+}
+
+void
+DemandKernel::scatter_batch(
+	size_t count,
+	uint128_t* demands,
+	uint128_t* supplies) const
+{
+	for (size_t i = 0; i < count; i++) {
+		demands[buy_assets[i]] += volumes[i];
+		supplies[sell_assets[i]] += volumes[i];
+	}
+}
+
+void
+DemandKernel::compute(
+	const Price* prices,
+	uint128_t* demands,
+	uint128_t* supplies,
+	const std::vector<Orderbook>& work_units,
+	size_t start,
+	size_t end,
+	const uint8_t smooth_mult)
+{
+	for (size_t batch_start = start; batch_start < end; batch_start += BATCH_SIZE) {
+		size_t count = std::min(BATCH_SIZE, end - batch_start);
+
+		if (load_batch(prices, work_units, batch_start, count, smooth_mult)) {
+			throw_metadata_error();
+		}
+		if (compute_batch(count, smooth_mult)) {
+			throw std::runtime_error("arithmetic error");
+		}
+		scatter_batch(count, demands, supplies);
+	}
+}
+
+void
+DemandKernel::compute_multi(
+	const Price* const* prices,
+	const size_t num_price_vectors,
+	uint128_t* const* demands,
+	uint128_t* const* supplies,
+	const std::vector<Orderbook>& work_units,
+	size_t start,
+	size_t end,
+	const uint8_t smooth_mult)
+{
+	for (size_t batch_start = start; batch_start < end; batch_start += BATCH_SIZE) {
+		size_t count = std::min(BATCH_SIZE, end - batch_start);
+
+		for (size_t k = 0; k < num_price_vectors; k++) {
+			if (load_batch(prices[k], work_units, batch_start, count, smooth_mult)) {
+				throw_metadata_error();
+			}
+			if (compute_batch(count, smooth_mult)) {
+				throw std::runtime_error("arithmetic error");
+			}
+			scatter_batch(count, demands[k], supplies[k]);
+		}
+	}
+}
+
+void
+DemandKernel::compute_volumes(
+	const Price* prices,
+	const std::vector<Orderbook>& work_units,
+	const uint32_t* book_idxs,
+	size_t count,
+	const uint8_t smooth_mult,
+	uint128_t* volumes_out)
+{
+	for (size_t batch_start = 0; batch_start < count; batch_start += BATCH_SIZE) {
+		size_t batch_count = std::min(BATCH_SIZE, count - batch_start);
+
+		bool metadata_error = false;
+		for (size_t i = 0; i < batch_count; i++) {
+			metadata_error |= load_book(
+				i, work_units[book_idxs[batch_start + i]], prices, smooth_mult);
+		}
+		if (metadata_error) {
+			throw_metadata_error();
+		}
+		if (compute_batch(batch_count, smooth_mult)) {
+			throw std::runtime_error("arithmetic error");
+		}
+		std::copy(volumes, volumes + batch_count, volumes_out + batch_start);
+	}
+}
+
+void
+IncrementalDemandKernel::reset_range(
+	const std::vector<Orderbook>& work_units,
+	size_t start,
+	size_t end,
+	size_t num_assets)
+{
+	cached_work_units = &work_units;
+	range_start = start;
+	range_end = end;
+
+	cached_prices.assign(num_assets, 0);
+	cached_volumes.assign(end - start, 0);
+	range_supplies.resize(num_assets);
+	range_demands.resize(num_assets);
+
+	books_by_asset.assign(num_assets, {});
+	for (size_t i = start; i < end; i++) {
+		auto category = work_units[i].get_category();
+		books_by_asset[category.sellAsset].push_back(i);
+		books_by_asset[category.buyAsset].push_back(i);
+	}
+
+	book_epochs.assign(end - start, 0);
+	epoch = 0;
+
+	dirty_books.reserve(end - start);
+	dirty_volumes.reserve(end - start);
+}
+
+void
+IncrementalDemandKernel::full_recompute(
+	const Price* prices,
+	const std::vector<Orderbook>& work_units,
+	const uint8_t smooth_mult)
+{
+	valid = false;
+
+	dirty_books.clear();
+	for (size_t i = range_start; i < range_end; i++) {
+		dirty_books.push_back(i);
+	}
+
+	kernel.compute_volumes(
+		prices, work_units, dirty_books.data(), dirty_books.size(), smooth_mult, cached_volumes.data());
+
+	range_supplies.clear();
+	range_demands.clear();
+
+	for (size_t i = range_start; i < range_end; i++) {
+		auto category = work_units[i].get_category();
+		range_demands.add(category.buyAsset, cached_volumes[i - range_start]);
+		range_supplies.add(category.sellAsset, cached_volumes[i - range_start]);
+	}
+
+	std::copy(prices, prices + cached_prices.size(), cached_prices.begin());
+	cached_smooth_mult = smooth_mult;
+	valid = true;
+}
+
+void
+IncrementalDemandKernel::collect_dirty_books(const Price* prices)
+{
+	dirty_books.clear();
+
+	epoch++;
+	if (epoch == 0) {
+		// wrapped around
+		std::fill(book_epochs.begin(), book_epochs.end(), 0);
+		epoch = 1;
+	}
+
+	for (size_t asset = 0; asset < cached_prices.size(); asset++) {
+		if (prices[asset] == cached_prices[asset]) {
+			continue;
+		}
+		for (uint32_t book : books_by_asset[asset]) {
+			if (book_epochs[book - range_start] != epoch) {
+				book_epochs[book - range_start] = epoch;
+				dirty_books.push_back(book);
+			}
+		}
+	}
+}
+
+void
+IncrementalDemandKernel::compute(
+	const Price* prices,
+	SplitAccumulatorVector& demands,
+	SplitAccumulatorVector& supplies,
+	const std::vector<Orderbook>& work_units,
+	size_t start,
+	size_t end,
+	size_t num_assets,
+	const uint8_t smooth_mult)
+{
+	if (cached_work_units != &work_units
+		|| range_start != start
+		|| range_end != end
+		|| cached_prices.size() != num_assets)
+	{
+		reset_range(work_units, start, end, num_assets);
+		valid = false;
+	}
+
+	if (!valid || cached_smooth_mult != smooth_mult) {
+		full_recompute(prices, work_units, smooth_mult);
+	} else {
+		collect_dirty_books(prices);
+
+		if (dirty_books.size() * FULL_RECOMPUTE_FRACTION > (end - start)) {
+			full_recompute(prices, work_units, smooth_mult);
+		} else if (dirty_books.size() > 0) {
+			valid = false;
+
+			dirty_volumes.resize(dirty_books.size());
+			kernel.compute_volumes(
+				prices, work_units, dirty_books.data(), dirty_books.size(), smooth_mult, dirty_volumes.data());
+
+			for (size_t i = 0; i < dirty_books.size(); i++) {
+				auto category = work_units[dirty_books[i]].get_category();
+				uint128_t& cached = cached_volumes[dirty_books[i] - range_start];
+
+				range_demands.sub(category.buyAsset, cached);
+				range_demands.add(category.buyAsset, dirty_volumes[i]);
+				range_supplies.sub(category.sellAsset, cached);
+				range_supplies.add(category.sellAsset, dirty_volumes[i]);
+				cached = dirty_volumes[i];
+			}
+			std::copy(prices, prices + num_assets, cached_prices.begin());
+			valid = true;
+		}
+	}
+
+	if (range_demands.overflowed() || range_supplies.overflowed()) {
+		valid = false;
+		range_demands.check_overflow();
+		range_supplies.check_overflow();
+	}
+
+	demands.add(range_demands);
+	supplies.add(range_supplies);
+}
+
+void
+IncrementalDemandKernel::compute_multi(
+	const Price* const* prices,
+	const size_t num_price_vectors,
+	uint128_t* const* demands,
+	uint128_t* const* supplies,
+	const std::vector<Orderbook>& work_units,
+	size_t start,
+	size_t end,
+	size_t num_assets,
+	const uint8_t smooth_mult)
+{
+	const bool cache_usable = valid
+		&& cached_work_units == &work_units
+		&& range_start == start
+		&& range_end == end
+		&& cached_prices.size() == num_assets
+		&& cached_smooth_mult == smooth_mult;
+
+	full_prices.clear();
+	full_demands.clear();
+	full_supplies.clear();
+
+	for (size_t k = 0; k < num_price_vectors; k++) {
+		if (cache_usable) {
+			collect_dirty_books(prices[k]);
+		}
+		if (!cache_usable || dirty_books.size() * FULL_RECOMPUTE_FRACTION > (end - start)) {
+			full_prices.push_back(prices[k]);
+			full_demands.push_back(demands[k]);
+			full_supplies.push_back(supplies[k]);
+			continue;
+		}
+
+		dirty_volumes.resize(dirty_books.size());
+		kernel.compute_volumes(
+			prices[k], work_units, dirty_books.data(), dirty_books.size(), smooth_mult, dirty_volumes.data());
+
+		// Like the outputs of DemandKernel::compute_multi(),
+		// these wrap around on overflow.
+		for (size_t i = 0; i < num_assets; i++) {
+			demands[k][i] += range_demands.get(i);
+			supplies[k][i] += range_supplies.get(i);
+		}
+		for (size_t i = 0; i < dirty_books.size(); i++) {
+			auto category = work_units[dirty_books[i]].get_category();
+			const uint128_t cached = cached_volumes[dirty_books[i] - range_start];
+
+			demands[k][category.buyAsset] += dirty_volumes[i] - cached;
+			supplies[k][category.sellAsset] += dirty_volumes[i] - cached;
+		}
+	}
+
+	if (full_prices.size() > 0) {
+		kernel.compute_multi(
+			full_prices.data(),
+			full_prices.size(),
+			full_demands.data(),
+			full_supplies.data(),
+			work_units,
+			start,
+			end,
+			smooth_mult);
+	}
+}
+
+} /* speedex */
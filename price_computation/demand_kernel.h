@@ -0,0 +1,242 @@
+#pragma once
+
+/**
+ * SPEEDEX: A Scalable, Parallelizable, and Economically Efficient Decentralized Exchange
+ * Copyright (C) 2023 Geoffrey Ramseyer
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! \file demand_kernel.h
+
+Batched supply/demand evaluation over a range of orderbooks.
+
+Computes the same values as calling
+Orderbook::calculate_demands_and_supplies_times_prices()
+on each orderbook, but in three passes over fixed-size batches:
+price index lookups, then trade volume arithmetic over packed
+(structure-of-arrays) per-book inputs, then the scatter into the
+supply/demand vectors.
+
+IncrementalDemandKernel additionally caches per-orderbook volumes
+between queries, and only recomputes orderbooks trading an asset
+whose price changed since the previous query.
+*/
+
+#include "orderbook/orderbook.h"
+
+#include "price_computation/split_accumulator.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace speedex {
+
+class DemandKernel {
+
+	using uint128_t = __uint128_t;
+
+public:
+	constexpr static size_t BATCH_SIZE = 64;
+
+private:
+
+	alignas(64) uint32_t sell_assets[BATCH_SIZE];
+	alignas(64) uint32_t buy_assets[BATCH_SIZE];
+
+	alignas(64) Price sell_prices[BATCH_SIZE];
+	alignas(64) Price buy_prices[BATCH_SIZE];
+
+	alignas(64) uint64_t full_exec_endows[BATCH_SIZE];
+	alignas(64) uint64_t partial_exec_endows[BATCH_SIZE];
+	alignas(64) uint128_t partial_exec_endow_times_prices[BATCH_SIZE];
+
+	alignas(64) uint128_t volumes[BATCH_SIZE];
+
+	//! Gather the inputs of one orderbook into lane \a lane.
+	//! Returns true if the index lookups are inconsistent.
+	bool load_book(
+		size_t lane,
+		const Orderbook& orderbook,
+		const Price* prices,
+		const uint8_t smooth_mult);
+
+	//! Pass 1: gather per-book inputs.  Index lookups for different
+	//! books are independent, so their cache misses overlap.
+	bool load_batch(
+		const Price* prices,
+		const std::vector<Orderbook>& work_units,
+		size_t start,
+		size_t count,
+		const uint8_t smooth_mult);
+
+	//! Pass 2: trade volumes.  Branch-free over the batch.
+	bool compute_batch(size_t count, const uint8_t smooth_mult);
+
+	//! Pass 3: accumulate into the output vectors.
+	void scatter_batch(
+		size_t count,
+		uint128_t* demands,
+		uint128_t* supplies) const;
+
+public:
+
+	//! Add the supplies and demands (times prices) of orderbooks
+	//! [start, end) to \a supplies and \a demands.
+	void compute(
+		const Price* prices,
+		uint128_t* demands,
+		uint128_t* supplies,
+		const std::vector<Orderbook>& work_units,
+		size_t start,
+		size_t end,
+		const uint8_t smooth_mult);
+
+	//! Add the supplies and demands (times prices) of orderbooks
+	//! [start, end) at each of num_price_vectors price vectors
+	//! (prices[k]) to supplies[k] and demands[k].
+	//! All price vectors are evaluated on one batch of orderbooks
+	//! before moving to the next, so each orderbook's index is
+	//! streamed through cache once.
+	void compute_multi(
+		const Price* const* prices,
+		const size_t num_price_vectors,
+		uint128_t* const* demands,
+		uint128_t* const* supplies,
+		const std::vector<Orderbook>& work_units,
+		size_t start,
+		size_t end,
+		const uint8_t smooth_mult);
+
+	//! Compute the trade volumes of orderbooks book_idxs[0..count),
+	//! writing volume of book_idxs[i] to volumes_out[i].
+	void compute_volumes(
+		const Price* prices,
+		const std::vector<Orderbook>& work_units,
+		const uint32_t* book_idxs,
+		size_t count,
+		const uint8_t smooth_mult,
+		uint128_t* volumes_out);
+};
+
+/*! Supply/demand evaluation over one fixed range of orderbooks,
+reusing results from the previous query.
+
+Keeps the trade volume of every orderbook in the range,
+and the range's aggregate supplies and demands.  A query
+recomputes only the orderbooks whose sell or buy price changed,
+and patches the aggregates by the change in volume.
+
+Cached results are keyed on the orderbook range and smooth_mult.
+Call invalidate() whenever the orderbooks themselves change
+(i.e. before each Tatonnement run).
+
+Not threadsafe.
+*/
+class IncrementalDemandKernel {
+
+	using uint128_t = __uint128_t;
+
+	DemandKernel kernel;
+
+	const std::vector<Orderbook>* cached_work_units = nullptr;
+	size_t range_start = 0;
+	size_t range_end = 0;
+	uint8_t cached_smooth_mult = 0;
+	bool valid = false;
+
+	//! Prices of the last query.
+	std::vector<Price> cached_prices;
+
+	//! Trade volume of orderbook range_start + i, at cached_prices.
+	std::vector<uint128_t> cached_volumes;
+
+	//! Aggregates over the range, at cached_prices.
+	SplitAccumulatorVector range_supplies;
+	SplitAccumulatorVector range_demands;
+
+	//! For each asset, the orderbooks in the range that trade it
+	//! (as sell or buy asset).
+	std::vector<std::vector<uint32_t>> books_by_asset;
+
+	//! Dedup for dirty_books; book i is in dirty_books iff
+	//! book_epochs[i - range_start] == epoch.
+	std::vector<uint32_t> book_epochs;
+	uint32_t epoch = 0;
+
+	std::vector<uint32_t> dirty_books;
+	std::vector<uint128_t> dirty_volumes;
+
+	//! Price vectors of a compute_multi() call that are recomputed
+	//! from scratch, and their outputs.
+	std::vector<const Price*> full_prices;
+	std::vector<uint128_t*> full_demands;
+	std::vector<uint128_t*> full_supplies;
+
+	//! If more than (1/FULL_RECOMPUTE_FRACTION) of the range changes,
+	//! recomputing everything is cheaper than patching.
+	constexpr static size_t FULL_RECOMPUTE_FRACTION = 2;
+
+	void reset_range(
+		const std::vector<Orderbook>& work_units,
+		size_t start,
+		size_t end,
+		size_t num_assets);
+
+	void full_recompute(
+		const Price* prices,
+		const std::vector<Orderbook>& work_units,
+		const uint8_t smooth_mult);
+
+	void collect_dirty_books(const Price* prices);
+
+public:
+
+	//! Discard cached results.
+	void invalidate() {
+		valid = false;
+	}
+
+	//! Add the supplies and demands (times prices) of orderbooks
+	//! [start, end) to \a supplies and \a demands.
+	//! Same output as DemandKernel::compute().
+	//! Throws if the range's aggregates overflow.
+	void compute(
+		const Price* prices,
+		SplitAccumulatorVector& demands,
+		SplitAccumulatorVector& supplies,
+		const std::vector<Orderbook>& work_units,
+		size_t start,
+		size_t end,
+		size_t num_assets,
+		const uint8_t smooth_mult);
+
+	//! Same output as DemandKernel::compute_multi().
+	//! Price vectors close to the cached prices patch the cached
+	//! results (as in compute()); the rest are computed together
+	//! by DemandKernel::compute_multi().
+	//! Does not update the cached results.
+	void compute_multi(
+		const Price* const* prices,
+		const size_t num_price_vectors,
+		uint128_t* const* demands,
+		uint128_t* const* supplies,
+		const std::vector<Orderbook>& work_units,
+		size_t start,
+		size_t end,
+		size_t num_assets,
+		const uint8_t smooth_mult);
+};
+
+} /* speedex */
@@ -20,29 +20,25 @@
 
 /*! \file demand_oracle.h
 
-Runs a single supply/demand query.
-Owns background threads to run these queries.
+Runs a single supply/demand query,
+on the threads of a shared DemandWorkerPool.
 */
 
 #include "orderbook/orderbook.h"
 #include "orderbook/utils.h"
 
-#include <utils/async_worker.h>
+#include "price_computation/demand_kernel.h"
+#include "price_computation/demand_worker_pool.h"
+#include "price_computation/split_accumulator.h"
 
-using uint128_t = __uint128_t;
-
-namespace speedex {
-
-/*! Demand computation worker.
+#include <utils/time.h>
 
-Each worker is assigned a range of orderbooks,
-and, when active, wait on a spinlock for 
-a signal from the main thread.
+#include <algorithm>
+#include <array>
 
-Otherwise, sleep as a regular AsyncWorker.
+using uint128_t = __uint128_t;
 
-Each worker should be assigned to only one ParallelDemandOracle.
-*/
+namespace speedex {
 
 #define USE_DEMAND_MULT_PRICES
 
@@ -52,249 +48,447 @@ constexpr static auto demand_func = &Orderbook::calculate_demands_and_supplies_t
 constexpr static auto demand_func = &Orderbook::calculate_demands_and_supplies;
 #endif
 
-class DemandOracleWorker : public utils::AsyncWorker {
-	
-	unsigned int num_assets;
+//! Compute supply/demand for orderbooks [start, end).
+//! With USE_DEMAND_MULT_PRICES, runs the batched kernel
+//! (same results as demand_func), recomputing only orderbooks
+//! whose prices changed since the kernel's previous query.
+inline void
+compute_demand_range(
+	IncrementalDemandKernel& kernel,
+	Price* active_prices,
+	SplitAccumulatorVector& supplies,
+	SplitAccumulatorVector& demands,
+	std::vector<Orderbook>& work_units,
+	size_t start,
+	size_t end,
+	unsigned int num_assets,
+	const uint8_t smooth_mult)
+{
+#ifdef USE_DEMAND_MULT_PRICES
+	kernel.compute(active_prices, demands, supplies, work_units, start, end, num_assets, smooth_mult);
+#else
+	std::vector<uint128_t> local_supplies(num_assets, 0), local_demands(num_assets, 0);
+	for (size_t i = start; i < end; i++) {
+		(work_units[i].*demand_func) (active_prices, local_demands.data(), local_supplies.data(), smooth_mult);
+	}
+	for (size_t i = 0; i < num_assets; i++) {
+		supplies.add(i, local_supplies[i]);
+		demands.add(i, local_demands[i]);
+	}
+#endif
+}
+
+/*! Parallelized oracle for supply and demand.
 
-	size_t starting_work_unit;
-	size_t ending_work_unit;
+Call activate_oracle() (deactivate_oracle()) before
+(after) usage to wake (let sleep) the pool's threads.
 
-	uint128_t* supplies;
-	uint128_t* demands;
+Orderbooks are split into NUM_SHARES contiguous shares of roughly equal
+estimated query cost (orderbook sizes are very skewed),
+recomputed on every activation.  Any pool thread (or the caller)
+can run any share; each share keeps its own cached results.
 
-	bool round_start = false;
-	
-	std::atomic<bool> tatonnement_round_flag = false;
-	std::atomic<bool> sleep_flag = false;
-	std::atomic<bool> round_done_flag = false;
+If orderbooks are placed on NUMA nodes (see
+OrderbookManager::get_numa_node_bounds()), shares are first divided
+evenly between nodes, and each node's orderbooks are balanced
+among its shares.  Pool threads prefer their own node's shares.
 
+Not threadsafe.  Each Tatonnement copy should have its own
+oracle.
+*/ 
+template<unsigned int NUM_SHARES>
+class ParallelDemandOracle : public DemandPoolJob {
 
-	Price* query_prices;
-	std::vector<Orderbook>* query_work_units;
-	uint8_t query_smooth_mult;
+	unsigned int num_assets;
 
-	bool exists_work_to_do() {
-		return round_start;
+	DemandWorkerPool& pool;
+
+	//! Share i is orderbooks [share_bounds[i], share_bounds[i+1]).
+	size_t share_bounds[NUM_SHARES + 1];
+
+	struct alignas(64) Share {
+		IncrementalDemandKernel kernel;
+		SplitAccumulatorVector supplies;
+		SplitAccumulatorVector demands;
+
+		//! For multi-vector queries (which use, but do not update,
+		//! the kernel's cached results).
+		//! num_assets entries per price vector.
+		std::vector<uint128_t> multi_supplies;
+		std::vector<uint128_t> multi_demands;
+		//! Start of each price vector's entries in the above.
+		//! Rebuilt only when the number of vectors changes.
+		std::vector<uint128_t*> multi_supplies_out;
+		std::vector<uint128_t*> multi_demands_out;
+
+		//! For Jacobian diagonal queries.
+		std::vector<double> jacobian_diagonal;
+
+		//! Time (seconds) spent computing since the last activation.
+		double compute_time = 0;
+	};
+
+	Share shares[NUM_SHARES];
+
+	//! Sum over shares, for the current query.
+	SplitAccumulatorVector total_supplies;
+	SplitAccumulatorVector total_demands;
+
+	Price* query_prices = nullptr;
+	std::vector<Orderbook>* query_work_units = nullptr;
+	uint8_t query_smooth_mult = 0;
+
+	//! Nonzero for multi-vector queries.
+	size_t query_num_price_vectors = 0;
+	const Price* const* query_price_vectors = nullptr;
+
+	//! Set for Jacobian diagonal queries.
+	bool query_jacobian = false;
+
+	//! Split orderbooks [book_start, book_end) between
+	//! shares [share_start, share_end).
+	void rebalance_range(
+		const std::vector<Orderbook>& work_units,
+		size_t book_start,
+		size_t book_end,
+		size_t share_start,
+		size_t share_end)
+	{
+		split_by_cost(
+			book_start, 
+			book_end, 
+			share_end - share_start,
+			[&work_units] (size_t i) {
+				return work_units[i].estimated_query_cost();
+			},
+			share_bounds + share_start);
 	}
 
-	//! Basic TTAS spinlock.
-	//! Includes memory fences so that main thread can safely 
-	//! read data that was written by this thread. 
-	//! Return true if thread should go to sleep
-	bool spinlock() {
-		while(true) {
-			bool next_round = tatonnement_round_flag.load(std::memory_order_relaxed);
-			if (next_round) {
-				tatonnement_round_flag.store(false, std::memory_order_relaxed);
-				std::atomic_thread_fence(std::memory_order_acquire);
-				return false;
-			}
-			bool sleep = sleep_flag.load(std::memory_order_relaxed);
-			if (sleep) {
-				sleep_flag.store(false, std::memory_order_relaxed);
-				return true;
+	void rebalance(
+		const std::vector<Orderbook>& work_units,
+		const std::vector<size_t>& numa_node_bounds)
+	{
+		size_t nodes = numa_node_bounds.size() < 2 ? 1 : numa_node_bounds.size() - 1;
+		if (nodes > NUM_SHARES || nodes > DemandPoolJob::MAX_NODES) {
+			nodes = 1;
+		}
+		if (nodes == 1) {
+			size_t share_node_bounds[2] = {0, NUM_SHARES};
+			rebalance_range(work_units, 0, work_units.size(), 0, NUM_SHARES);
+			set_share_nodes(share_node_bounds, 1);
+			return;
+		}
+
+		size_t share_node_bounds[DemandPoolJob::MAX_NODES + 1];
+		for (size_t n = 0; n <= nodes; n++) {
+			share_node_bounds[n] = (NUM_SHARES * n) / nodes;
+		}
+		for (size_t n = 0; n < nodes; n++) {
+			rebalance_range(
+				work_units, 
+				numa_node_bounds[n],
+				numa_node_bounds[n+1],
+				share_node_bounds[n],
+				share_node_bounds[n+1]);
+		}
+		set_share_nodes(share_node_bounds, nodes);
+	}
+
+	void run_multi_share(Share& share, size_t idx) {
+		const size_t k_max = query_num_price_vectors;
+		if (share.multi_supplies_out.size() != k_max) {
+			share.multi_supplies.resize(k_max * num_assets);
+			share.multi_demands.resize(k_max * num_assets);
+			share.multi_supplies_out.resize(k_max);
+			share.multi_demands_out.resize(k_max);
+			for (size_t k = 0; k < k_max; k++) {
+				share.multi_supplies_out[k] = share.multi_supplies.data() + k * num_assets;
+				share.multi_demands_out[k] = share.multi_demands.data() + k * num_assets;
 			}
-			__builtin_ia32_pause();
 		}
+		std::fill(share.multi_supplies.begin(), share.multi_supplies.end(), 0);
+		std::fill(share.multi_demands.begin(), share.multi_demands.end(), 0);
+
+		share.kernel.compute_multi(
+			query_price_vectors,
+			k_max,
+			share.multi_demands_out.data(),
+			share.multi_supplies_out.data(),
+			*query_work_units,
+			share_bounds[idx],
+			share_bounds[idx + 1],
+			num_assets,
+			query_smooth_mult);
 	}
 
-	//! Compute supply/demand for this worker's
-	//! assigned orderbooks.
+	void run_jacobian_share(Share& share, size_t idx) {
+		share.jacobian_diagonal.assign(num_assets, 0.0);
+		auto const& work_units = *query_work_units;
+		for (size_t i = share_bounds[idx]; i < share_bounds[idx + 1]; i++) {
+			double sensitivity = work_units[i].trade_volume_sensitivity(query_prices, query_smooth_mult);
+			auto category = work_units[i].get_category();
+			share.jacobian_diagonal[category.sellAsset] += sensitivity;
+			share.jacobian_diagonal[category.buyAsset] += sensitivity;
+		}
+	}
+
+	void run_share(size_t idx) override final {
+		auto timestamp = utils::init_time_measurement();
+		auto& share = shares[idx];
+
+		if (query_jacobian) {
+			run_jacobian_share(share, idx);
+			share.compute_time += utils::measure_time(timestamp);
+			return;
+		}
+
+		if (query_num_price_vectors > 0) {
+			run_multi_share(share, idx);
+			share.compute_time += utils::measure_time(timestamp);
+			return;
+		}
+
+		share.supplies.clear();
+		share.demands.clear();
+
+		compute_demand_range(
+			share.kernel, 
+			query_prices, 
+			share.supplies, 
+			share.demands, 
+			*query_work_units, 
+			share_bounds[idx], 
+			share_bounds[idx + 1], 
+			num_assets, 
+			query_smooth_mult);
+
+		share.compute_time += utils::measure_time(timestamp);
+	}
+
+public:
+	//! Initialize oracle with a given number of assets and a given
+	//! number of orderbooks.
+	ParallelDemandOracle(size_t num_work_units, size_t num_assets, DemandWorkerPool& pool)
+		: DemandPoolJob(NUM_SHARES)
+		, num_assets(num_assets)
+		, pool(pool)
+	{
+		for (size_t i = 0; i <= NUM_SHARES; i++) {
+			share_bounds[i] = (num_work_units * i) / NUM_SHARES;
+		}
+		for (auto& share : shares) {
+			share.supplies.resize(num_assets);
+			share.demands.resize(num_assets);
+		}
+		total_supplies.resize(num_assets);
+		total_demands.resize(num_assets);
+		pool.register_job(this);
+	}
+
+	~ParallelDemandOracle() {
+		pool.unregister_job(this);
+	}
+
+	//! Compute supply/demand using pool threads.
 	void get_supply_demand(
 		Price* active_prices,
 		uint128_t* supplies, 
 		uint128_t* demands, 
 		std::vector<Orderbook>& work_units,
 		const uint8_t smooth_mult) {
-			
-			for (size_t i = starting_work_unit; i < ending_work_unit; i++) {
-				(work_units[i].*demand_func) (active_prices, demands, supplies, smooth_mult);
-			}
-	}
 
-	void run() {
-		std::unique_lock lock(mtx);
+		query_prices = active_prices;
+		query_work_units = &work_units;
+		query_smooth_mult = smooth_mult;
+		query_num_price_vectors = 0;
+		query_jacobian = false;
 
-		while(true) {
+		run_all_shares();
 
-			if ((!done_flag) && (!exists_work_to_do())) {
-				cv.wait(lock, [this] () { return done_flag || exists_work_to_do();});
-			}
-			if (done_flag) return;
-			if (round_start) {
-				round_start = false;
-				
-				while(!spinlock()) {
-					for (size_t i = 0; i < num_assets; i++) {
-						supplies[i] = 0;
-						demands[i] = 0;
-					}
-
-					get_supply_demand(query_prices, supplies, demands, *query_work_units, query_smooth_mult);
-					signal_round_compute_done();
-				}
-			}
-			cv.notify_all();
+		total_supplies.clear();
+		total_demands.clear();
+		for (auto const& share : shares) {
+			total_supplies.add(share.supplies);
+			total_demands.add(share.demands);
 		}
-	}
+		total_supplies.check_overflow();
+		total_demands.check_overflow();
 
-	//! Signal to main thread that local work is finished.
-	void signal_round_compute_done() {
-		std::atomic_thread_fence(std::memory_order_release);
-		round_done_flag.store(true, std::memory_order_relaxed);
+		for (size_t i = 0; i < num_assets; i++) {
+			demands[i] += total_demands.get(i);
+			supplies[i] += total_supplies.get(i);
+		}
 	}
-public:
 
-	//! Initialize this demand worker to run on orderbooks between starting_work_unit (incl)
-	//! and ending_work_unit (excl)
-	void init(unsigned int num_assets_, size_t starting_work_unit_, size_t ending_work_unit_) {
-		num_assets = num_assets_;
-		starting_work_unit = starting_work_unit_;
-		ending_work_unit = ending_work_unit_;
-		supplies = new uint128_t[num_assets];
-		demands = new uint128_t[num_assets];
-		start_async_thread([this] {run();});
-	}
+	//! Compute supply/demand at each of num_price_vectors price vectors
+	//! (e.g. several candidate step sizes), adding the results for
+	//! prices[k] to supplies[k] and demands[k].
+	//! Each orderbook's index is read once for all of the vectors.
+	//! Vectors that differ from the prices of the last
+	//! get_supply_demand() in only a few assets reuse its cached
+	//! results (without disturbing them).
+	void get_supply_demand_multi(
+		const Price* const* prices,
+		const size_t num_price_vectors,
+		uint128_t* const* supplies,
+		uint128_t* const* demands,
+		std::vector<Orderbook>& work_units,
+		const uint8_t smooth_mult) {
 
-	~DemandOracleWorker() {
-		terminate_worker();
-		delete[] demands;
-		delete[] supplies;
-	}
+		if (num_price_vectors == 0) {
+			return;
+		}
+
+		query_price_vectors = prices;
+		query_num_price_vectors = num_price_vectors;
+		query_work_units = &work_units;
+		query_smooth_mult = smooth_mult;
+		query_jacobian = false;
 
-	//! Called by main thread to wait (on a TTAS spinlock) for
-	//! worker thread to finish.
-	void wait_for_compute_done_and_get_results(uint128_t* demands_out, uint128_t* supplies_out) {
-		while(true) {
-			bool res = round_done_flag.load(std::memory_order_relaxed);
-			if (res) {
-				round_done_flag.store(false, std::memory_order_relaxed);
-				std::atomic_thread_fence(std::memory_order_acquire);
+		run_all_shares();
 
+		for (auto const& share : shares) {
+			for (size_t k = 0; k < num_price_vectors; k++) {
 				for (size_t i = 0; i < num_assets; i++) {
-					demands_out[i] += demands[i];
-					supplies_out[i] += supplies[i];
+					demands[k][i] += share.multi_demands[k * num_assets + i];
+					supplies[k][i] += share.multi_supplies[k * num_assets + i];
 				}
-				return;
 			}
-			__builtin_ia32_pause();
 		}
 	}
 
-	//! Called by main thread to start worker on a given
-	//! set of prices.
-	void signal_round_start(
-		Price* prices, 
-		std::vector<Orderbook>* work_units, 
-		uint8_t smooth_mult) 
-	{
+	//! Estimate the diagonal of the Jacobian of excess demand (with
+	//! respect to log prices), as a sum of trade volume sensitivities
+	//! over each asset's orderbooks, using pool threads.
+	//! Each orderbook contributes to exactly two assets.
+	//! Does not use (or disturb) the cached results of get_supply_demand().
+	void get_jacobian_diagonal(
+		Price* prices,
+		std::vector<Orderbook>& work_units,
+		const uint8_t smooth_mult,
+		std::vector<double>& out) {
+
 		query_prices = prices;
-		query_work_units = work_units;
+		query_work_units = &work_units;
 		query_smooth_mult = smooth_mult;
-		std::atomic_thread_fence(std::memory_order_release);
-		tatonnement_round_flag.store(true, std::memory_order_relaxed);
-	}
-
-	//! Activates worker from sleep.
-	//! Worker begins waiting on a spinlock for a further signal.
-	void activate_worker() {
-		std::lock_guard lock(mtx);
-		round_start = true;
-		cv.notify_one();
-	}
-	//! Puts worker to sleep.
-	void deactivate_worker() {
-		sleep_flag.store(true, std::memory_order_relaxed);
-	}
-};
-
+		query_num_price_vectors = 0;
+		query_jacobian = true;
 
-/*! Parallelized oracle for supply and demand.
+		run_all_shares();
 
-Call activate_oracle() (deactivate_oracle()) before
-(after) usage to wake (put to sleep) the background threads.
+		query_jacobian = false;
 
-Each worker should be assigned to only one ParallelDemandOracle.
+		out.assign(num_assets, 0.0);
+		for (auto const& share : shares) {
+			for (size_t i = 0; i < num_assets; i++) {
+				out[i] += share.jacobian_diagonal[i];
+			}
+		}
+	}
 
-Not threadsafe.  Each Tatonnement copy should have its own
-oracle.
+	//! Rebalance orderbooks between shares, then wake 
+	//! pool threads.
+	//! Call after orderbooks change (i.e. once per Tatonnement run).
+	//! numa_node_bounds, if nonempty, gives the orderbook range
+	//! placed on each NUMA node.
+	void activate_oracle(
+		const std::vector<Orderbook>& work_units,
+		const std::vector<size_t>& numa_node_bounds = {}) {
+		rebalance(work_units, numa_node_bounds);
+		for (auto& share : shares) {
+			// orderbooks may have changed since the last activation
+			share.kernel.invalidate();
+			share.compute_time = 0;
+		}
+		pool.activate_job();
+	}
 
-*/ 
-template<unsigned int NUM_WORKERS>
-class ParallelDemandOracle {
+	//! Release pool threads (they sleep if no oracle is active).
+	void deactivate_oracle() {
+		pool.deactivate_job();
+	}
 
-	size_t num_work_units;
+	//! Per-share compute time (seconds) since activation, for
+	//! checking load balance.
+	//! Call between queries (not concurrently with get_supply_demand()).
+	std::array<double, NUM_SHARES> get_share_compute_times() const {
+		std::array<double, NUM_SHARES> out;
+		for (size_t i = 0; i < NUM_SHARES; i++) {
+			out[i] = shares[i].compute_time;
+		}
+		return out;
+	}
+};
 
-	unsigned int num_assets;
+/*! Price vectors, and their supplies and demands, for repeated
+multi-vector queries (ParallelDemandOracle::get_supply_demand_multi()).
+Allocated once, up front.
+*/
+class MultiPriceQueryWorkspace {
 
-	//! Caller thread is reponsible for orderbooks from
-	//! main_thread_start_idx(incl) to main_thread_end_idx(excl)
-	constexpr static size_t main_thread_start_idx = 0;
+	const size_t num_assets;
+	const size_t num_vectors;
 
-	//! Caller thread is reponsible for orderbooks from
-	//! main_thread_start_idx(incl) to main_thread_end_idx(excl)
-	const size_t main_thread_end_idx;
+	//! num_assets entries per price vector.
+	std::vector<Price> prices;
+	std::vector<uint128_t> supplies;
+	std::vector<uint128_t> demands;
 
-	DemandOracleWorker workers[NUM_WORKERS];
+	std::vector<const Price*> price_ptrs;
+	std::vector<uint128_t*> supply_ptrs;
+	std::vector<uint128_t*> demand_ptrs;
 
 public:
-	//! Initialize oracle with a given number of assets and a given
-	//! number of orderbooks.
-	ParallelDemandOracle(size_t num_work_units, size_t num_assets)
-		: num_work_units(num_work_units)
-		, num_assets(num_assets)
-		, main_thread_end_idx(num_work_units / (NUM_WORKERS + 1))
-	{
 
-		size_t num_shares = NUM_WORKERS + 1;
-		//main_thread_end_idx = num_work_units / (num_shares);
-
-		for (size_t i = 0; i < NUM_WORKERS; i++) {
-			size_t start_idx = (num_work_units * (i+1)) / num_shares;
-			size_t end_idx = (num_work_units * (i+2)) / num_shares;
-			workers[i].init(num_assets, start_idx, end_idx);
+	MultiPriceQueryWorkspace(size_t num_assets, size_t num_vectors)
+		: num_assets(num_assets)
+		, num_vectors(num_vectors)
+		, prices(num_assets * num_vectors, 0)
+		, supplies(num_assets * num_vectors, 0)
+		, demands(num_assets * num_vectors, 0)
+	{
+		for (size_t k = 0; k < num_vectors; k++) {
+			price_ptrs.push_back(prices.data() + k * num_assets);
+			supply_ptrs.push_back(supplies.data() + k * num_assets);
+			demand_ptrs.push_back(demands.data() + k * num_assets);
 		}
 	}
 
-	//! Compute supply/demand using worker threads.
-	void get_supply_demand(
-		Price* active_prices,
-		uint128_t* supplies, 
-		uint128_t* demands, 
-		std::vector<Orderbook>& work_units,
-		const uint8_t smooth_mult) {
-
-		// Start compute round
-		for (size_t i = 0; i < NUM_WORKERS; i++) {
-			workers[i].signal_round_start(active_prices, &work_units, smooth_mult);
-		}
-
-		// Do work in main thread
-		for (size_t i = main_thread_start_idx; i < main_thread_end_idx; i++) {
-			(work_units[i].*demand_func)(active_prices, demands, supplies, smooth_mult);
-		}
-
-		// Gather results from workers
-		for (size_t i = 0; i < NUM_WORKERS; i++) {
-			workers[i].wait_for_compute_done_and_get_results(demands, supplies);
-		}
+	size_t size() const {
+		return num_vectors;
 	}
 
-	//! Wake worker threads, set them to wait
-	//! on spinlocks for round start
-	void activate_oracle() {
-		for (size_t i = 0; i < NUM_WORKERS; i++) {
-			workers[i].activate_worker();
-		}
+	//! Price vector k, to be filled in before query().
+	Price* get_prices(size_t k) {
+		return prices.data() + k * num_assets;
 	}
 
-	//! Put worker threads to sleep
-	void deactivate_oracle() {
-		for (size_t i = 0; i < NUM_WORKERS; i++) {
-			workers[i].deactivate_worker();
-		}
+	//! Results for price vector k, after query().
+	const uint128_t* get_supplies(size_t k) const {
+		return supply_ptrs[k];
+	}
+	const uint128_t* get_demands(size_t k) const {
+		return demand_ptrs[k];
 	}
 
+	//! Compute supply/demand at every price vector, replacing
+	//! the results of any previous query.
+	template<unsigned int NUM_SHARES>
+	void query(
+		ParallelDemandOracle<NUM_SHARES>& oracle,
+		std::vector<Orderbook>& work_units,
+		const uint8_t smooth_mult)
+	{
+		std::fill(supplies.begin(), supplies.end(), 0);
+		std::fill(demands.begin(), demands.end(), 0);
+		oracle.get_supply_demand_multi(
+			price_ptrs.data(),
+			num_vectors,
+			supply_ptrs.data(),
+			demand_ptrs.data(),
+			work_units,
+			smooth_mult);
+	}
 };
 
 } /* speedex */
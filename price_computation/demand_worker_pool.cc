@@ -0,0 +1,235 @@
+/**
+ * SPEEDEX: A Scalable, Parallelizable, and Economically Efficient Decentralized Exchange
+ * Copyright (C) 2023 Geoffrey Ramseyer
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "price_computation/demand_worker_pool.h"
+
+#include "utils/debug_macros.h"
+#include "utils/numa_topology.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <stdexcept>
+
+namespace speedex {
+
+static bool
+claimable(uint64_t next_and_end)
+{
+	return (next_and_end & UINT32_MAX) < (next_and_end >> 32);
+}
+
+void
+DemandPoolJob::set_share_nodes(const size_t* share_node_bounds, size_t nodes)
+{
+	if (nodes == 0 || nodes > MAX_NODES
+		|| share_node_bounds[0] != 0 || share_node_bounds[nodes] != num_shares)
+	{
+		throw std::runtime_error("invalid share node assignment");
+	}
+	for (size_t i = 0; i <= nodes; i++) {
+		node_bounds[i].store(share_node_bounds[i], std::memory_order_relaxed);
+	}
+	num_nodes.store(nodes, std::memory_order_relaxed);
+}
+
+bool
+DemandPoolJob::try_run_one_share_from(size_t node)
+{
+	auto& claim = claims[node].next_and_end;
+
+	// TTAS: avoid writing to the job's cache lines while it is idle
+	if (!claimable(claim.load(std::memory_order_relaxed))) {
+		return false;
+	}
+	uint64_t next_and_end = claim.fetch_add(1, std::memory_order_acq_rel);
+	if (!claimable(next_and_end)) {
+		return false;
+	}
+	run_share(next_and_end & UINT32_MAX);
+	shares_remaining.fetch_sub(1, std::memory_order_release);
+	return true;
+}
+
+bool
+DemandPoolJob::try_run_one_share(size_t preferred_node)
+{
+	size_t nodes = num_nodes.load(std::memory_order_relaxed);
+	for (size_t i = 0; i < nodes; i++) {
+		if (try_run_one_share_from((preferred_node + i) % nodes)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void
+DemandPoolJob::run_all_shares()
+{
+	shares_remaining.store(num_shares, std::memory_order_relaxed);
+
+	size_t nodes = num_nodes.load(std::memory_order_relaxed);
+	for (size_t i = 0; i < nodes; i++) {
+		uint64_t start = node_bounds[i].load(std::memory_order_relaxed);
+		uint64_t end = node_bounds[i+1].load(std::memory_order_relaxed);
+		claims[i].next_and_end.store((end << 32) | start, std::memory_order_release);
+	}
+
+	while (try_run_one_share(0)) {}
+
+	while (shares_remaining.load(std::memory_order_acquire) != 0) {
+		__builtin_ia32_pause();
+	}
+}
+
+DemandWorkerPool::DemandWorkerPool(size_t num_threads, int first_core, bool numa_aware)
+	: thread_nodes(num_threads, 0)
+	, thread_states(num_threads)
+{
+	for (auto& job : jobs) {
+		job.store(nullptr, std::memory_order_relaxed);
+	}
+	if (numa_aware) {
+		size_t nodes = NumaTopology::get().num_nodes();
+		for (size_t i = 0; i < num_threads; i++) {
+			thread_nodes[i] = i % nodes;
+		}
+		first_core = -1;
+	}
+	for (size_t i = 0; i < num_threads; i++) {
+		int core = (first_core < 0) ? -1 : first_core + i;
+		threads.emplace_back([this, i, core, numa_aware] {
+			if (numa_aware && !NumaTopology::get().pin_current_thread(thread_nodes[i])) {
+				TAT_INFO("failed to pin demand pool thread %lu to numa node %lu", i, thread_nodes[i]);
+			}
+			run(i, core);
+		});
+	}
+}
+
+DemandWorkerPool::~DemandWorkerPool()
+{
+	{
+		std::lock_guard lock(mtx);
+		shutdown_flag = true;
+	}
+	cv.notify_all();
+	for (auto& t : threads) {
+		t.join();
+	}
+}
+
+void
+DemandWorkerPool::run(size_t thread_idx, int core)
+{
+	if (core >= 0) {
+		cpu_set_t cpuset;
+		CPU_ZERO(&cpuset);
+		CPU_SET(core, &cpuset);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset) != 0) {
+			TAT_INFO("failed to pin demand pool thread %lu to core %d", thread_idx, core);
+		}
+	}
+
+	auto& state = thread_states[thread_idx];
+	const size_t node = thread_nodes[thread_idx];
+
+	while (true) {
+		{
+			std::unique_lock lock(mtx);
+			state.asleep.store(true, std::memory_order_seq_cst);
+			cv.wait(lock, [this] {
+				return shutdown_flag || num_active_jobs.load(std::memory_order_relaxed) > 0;
+			});
+			if (shutdown_flag) return;
+			state.asleep.store(false, std::memory_order_seq_cst);
+		}
+
+		while (num_active_jobs.load(std::memory_order_relaxed) > 0) {
+			bool found_work = false;
+			for (auto& slot : jobs) {
+				DemandPoolJob* job = slot.load(std::memory_order_seq_cst);
+				if (job != nullptr) {
+					found_work |= job->try_run_one_share(node);
+				}
+			}
+			state.passes.fetch_add(1, std::memory_order_release);
+			if (!found_work) {
+				__builtin_ia32_pause();
+			}
+		}
+	}
+}
+
+void
+DemandWorkerPool::register_job(DemandPoolJob* job)
+{
+	std::lock_guard lock(mtx);
+	for (auto& slot : jobs) {
+		if (slot.load(std::memory_order_relaxed) == nullptr) {
+			slot.store(job, std::memory_order_seq_cst);
+			return;
+		}
+	}
+	throw std::runtime_error("too many jobs registered to demand worker pool");
+}
+
+void
+DemandWorkerPool::unregister_job(DemandPoolJob* job)
+{
+	{
+		std::lock_guard lock(mtx);
+		bool found = false;
+		for (auto& slot : jobs) {
+			if (slot.load(std::memory_order_relaxed) == job) {
+				slot.store(nullptr, std::memory_order_seq_cst);
+				found = true;
+			}
+		}
+		if (!found) {
+			throw std::runtime_error("unregistering unknown job");
+		}
+	}
+
+	// A thread that is asleep, or that has finished a scan since
+	// the slot was cleared, can no longer hold a pointer to the job.
+	for (auto& state : thread_states) {
+		uint64_t passes = state.passes.load(std::memory_order_acquire);
+		while (!state.asleep.load(std::memory_order_seq_cst)
+			&& state.passes.load(std::memory_order_acquire) == passes) {
+			__builtin_ia32_pause();
+		}
+	}
+}
+
+void
+DemandWorkerPool::activate_job()
+{
+	if (num_active_jobs.fetch_add(1, std::memory_order_relaxed) == 0) {
+		std::lock_guard lock(mtx);
+		cv.notify_all();
+	}
+}
+
+void
+DemandWorkerPool::deactivate_job()
+{
+	num_active_jobs.fetch_sub(1, std::memory_order_relaxed);
+}
+
+} /* speedex */
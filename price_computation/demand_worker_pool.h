@@ -0,0 +1,177 @@
+#pragma once
+
+/**
+ * SPEEDEX: A Scalable, Parallelizable, and Economically Efficient Decentralized Exchange
+ * Copyright (C) 2023 Geoffrey Ramseyer
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! \file demand_worker_pool.h
+
+One pool of demand computation threads, shared by all of the 
+concurrent Tatonnement query threads.
+
+Each demand query is split into a fixed number of shares.
+The thread making a query publishes it, runs shares itself,
+and pool threads claim any remaining shares.
+
+Shares can be grouped by NUMA node.  A pool thread pinned
+to a node claims that node's shares first, and only then
+helps with the shares of other nodes.
+*/
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <utils/non_movable.h>
+
+namespace speedex {
+
+class DemandWorkerPool;
+
+/*! A demand query, split into shares that can run on any thread.
+
+A job is registered with a pool for its whole lifetime,
+and is idle whenever it has no unclaimed shares.
+*/
+class DemandPoolJob : private utils::NonMovableOrCopyable {
+
+	friend class DemandWorkerPool;
+
+public:
+
+	constexpr static size_t MAX_NODES = 8;
+
+private:
+
+	const uint64_t num_shares;
+
+	//! Shares of node n are [node_bounds[n], node_bounds[n+1]).
+	//! Only changed while no query is running.
+	std::atomic<uint32_t> node_bounds[MAX_NODES + 1];
+	std::atomic<uint32_t> num_nodes;
+
+	//! Per node, (end of the node's shares) << 32 | (next share to claim).
+	//! A share is claimable iff next < end, so a claim (one fetch_add)
+	//! never needs to read anything else, and a late claim from the
+	//! previous query can never succeed.
+	struct alignas(64) NodeClaims {
+		std::atomic<uint64_t> next_and_end = 0;
+	};
+
+	NodeClaims claims[MAX_NODES];
+
+	//! Shares claimed but not yet finished (or not yet claimed).
+	std::atomic<uint64_t> shares_remaining;
+
+	bool try_run_one_share_from(size_t node);
+
+	//! Claim and run one share, if one is available, trying
+	//! the shares of \a preferred_node first.
+	//! Returns false if no share was available.
+	bool try_run_one_share(size_t preferred_node);
+
+protected:
+
+	DemandPoolJob(uint64_t num_shares)
+		: num_shares(num_shares)
+		, num_nodes(1)
+		, shares_remaining(0)
+	{
+		node_bounds[0] = 0;
+		for (size_t i = 1; i <= MAX_NODES; i++) {
+			node_bounds[i] = num_shares;
+		}
+	}
+
+	//! Assign shares [share_node_bounds[n], share_node_bounds[n+1])
+	//! to node n, for n < nodes.  Call only between queries.
+	void set_share_nodes(const size_t* share_node_bounds, size_t nodes);
+
+	//! Compute one share of the current query.  Called by at most one
+	//! thread per share per query.
+	virtual void run_share(size_t share) = 0;
+
+	//! Publish a query (set up by the caller before this call),
+	//! help run it, and wait for all shares to finish.
+	void run_all_shares();
+
+public:
+
+	virtual ~DemandPoolJob() = default;
+};
+
+/*! Worker threads for running DemandPoolJob shares.
+
+Threads sleep while no job is active, and spin (on a TTAS check
+of each registered job) while any job is active.
+Optionally pins thread i to core (first_core + i).
+*/
+class DemandWorkerPool : private utils::NonMovableOrCopyable {
+
+	constexpr static size_t MAX_JOBS = 32;
+
+	std::atomic<DemandPoolJob*> jobs[MAX_JOBS];
+
+	std::atomic<uint32_t> num_active_jobs = 0;
+
+	//! NUMA node (index into NumaTopology) of each thread.
+	std::vector<size_t> thread_nodes;
+
+	struct alignas(64) ThreadState {
+		//! Incremented after every scan of the job list.
+		std::atomic<uint64_t> passes = 0;
+		std::atomic<bool> asleep = true;
+	};
+
+	std::vector<ThreadState> thread_states;
+	std::vector<std::thread> threads;
+
+	std::mutex mtx;
+	std::condition_variable cv;
+	bool shutdown_flag = false;
+
+	void run(size_t thread_idx, int core);
+
+public:
+
+	//! first_core < 0 disables pinning to cores.
+	//! If numa_aware, threads are instead spread round-robin across
+	//! NUMA nodes, and each is pinned to the cpus of its node.
+	DemandWorkerPool(size_t num_threads, int first_core = -1, bool numa_aware = false);
+
+	~DemandWorkerPool();
+
+	//! Jobs must be registered before use, and unregistered
+	//! before they are destroyed.
+	void register_job(DemandPoolJob* job);
+
+	//! Blocks until no pool thread can still access \a job.
+	void unregister_job(DemandPoolJob* job);
+
+	//! Wake pool threads (if needed) to serve an active job.
+	void activate_job();
+	void deactivate_job();
+
+	size_t num_threads() const {
+		return threads.size();
+	}
+};
+
+} /* speedex */
@@ -0,0 +1,105 @@
+/**
+ * SPEEDEX: A Scalable, Parallelizable, and Economically Efficient Decentralized Exchange
+ * Copyright (C) 2023 Geoffrey Ramseyer
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "price_computation/lp_check_pool.h"
+
+namespace speedex {
+
+bool
+LPFeasibilityCheck::try_submit(const Price* trial_prices, size_t num_assets, const ApproximationParameters& params) {
+	std::lock_guard lock(pool.mtx);
+	if (state != State::IDLE) {
+		return false;
+	}
+	prices.assign(trial_prices, trial_prices + num_assets);
+	approx_params = params;
+	state = State::PENDING;
+	pool.queue.push_back(this);
+	pool.work_cv.notify_one();
+	return true;
+}
+
+std::optional<bool>
+LPFeasibilityCheck::poll() {
+	std::lock_guard lock(pool.mtx);
+	if (state != State::DONE) {
+		return std::nullopt;
+	}
+	state = State::IDLE;
+	return result;
+}
+
+void
+LPFeasibilityCheck::wait() {
+	std::unique_lock lock(pool.mtx);
+	pool.done_cv.wait(lock, [this] {
+		return state != State::PENDING;
+	});
+	state = State::IDLE;
+}
+
+LPFeasibilityCheckPool::LPFeasibilityCheckPool(LPSolver& solver, size_t num_threads)
+	: solver(solver)
+{
+	for (size_t i = 0; i < num_threads; i++) {
+		threads.emplace_back([this] {
+			LPThreadEnvGuard env_guard(this->solver);
+			run();
+		});
+	}
+}
+
+LPFeasibilityCheckPool::~LPFeasibilityCheckPool() {
+	{
+		std::lock_guard lock(mtx);
+		shutdown_flag = true;
+		work_cv.notify_all();
+	}
+	for (auto& t : threads) {
+		t.join();
+	}
+}
+
+void
+LPFeasibilityCheckPool::run() {
+	while (true) {
+		std::unique_lock lock(mtx);
+		work_cv.wait(lock, [this] {
+			return shutdown_flag || (queue.size() > 0);
+		});
+		if (shutdown_flag) {
+			return;
+		}
+
+		LPFeasibilityCheck* check = queue.front();
+		queue.pop_front();
+		lock.unlock();
+
+		// Only this thread touches the check's prices and instance
+		// while it is pending.
+		bool result = solver.check_feasibility(
+			check->prices.data(), check->instance, check->approx_params);
+
+		lock.lock();
+		check->result = result;
+		check->state = LPFeasibilityCheck::State::DONE;
+		done_cv.notify_all();
+	}
+}
+
+} /* speedex */
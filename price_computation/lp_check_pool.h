@@ -0,0 +1,142 @@
+/**
+ * SPEEDEX: A Scalable, Parallelizable, and Economically Efficient Decentralized Exchange
+ * Copyright (C) 2023 Geoffrey Ramseyer
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/*! \file lp_check_pool.h
+
+Threads for running Tatonnement's periodic LP feasibility checks
+off of the Tatonnement query threads.
+
+A query thread submits a copy of its current trial prices, keeps
+iterating, and polls for the result.  Each query thread has at most
+one check in flight.
+*/
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include <utils/non_movable.h>
+
+#include "price_computation/lp_solver.h"
+
+#include "speedex/approximation_parameters.h"
+
+#include "xdr/types.h"
+
+namespace speedex {
+
+class LPFeasibilityCheckPool;
+
+/*! One query thread's slot for LP feasibility checks.
+
+Owned by the query thread.  Call wait() before anything that could
+modify the orderbooks (i.e. before a Tatonnement query returns),
+and before destroying the slot.
+*/
+class LPFeasibilityCheck : private utils::NonMovableOrCopyable {
+
+	friend class LPFeasibilityCheckPool;
+
+	enum class State {
+		IDLE,
+		PENDING,
+		DONE
+	};
+
+	LPFeasibilityCheckPool& pool;
+	std::unique_ptr<LPInstance> instance;
+
+	std::vector<Price> prices;
+	ApproximationParameters approx_params;
+
+	//! Guarded by the pool's mutex.
+	State state = State::IDLE;
+	bool result = false;
+
+public:
+
+	LPFeasibilityCheck(LPFeasibilityCheckPool& pool, std::unique_ptr<LPInstance> instance)
+		: pool(pool)
+		, instance(std::move(instance))
+		, prices()
+		, approx_params() {}
+
+	//! Start a check of \a trial_prices.  Returns false (and does
+	//! nothing) if a check is still in flight or its result unread.
+	bool try_submit(const Price* trial_prices, size_t num_assets, const ApproximationParameters& params);
+
+	//! Result of the last submitted check, if finished.
+	//! Reading a result frees the slot for the next submission.
+	std::optional<bool> poll();
+
+	//! Prices of the last submitted check.  Valid after poll()
+	//! returns a result, until the next submission.
+	const std::vector<Price>& get_checked_prices() const {
+		return prices;
+	}
+
+	//! Wait for any check in flight, and discard its result.
+	void wait();
+};
+
+/*! Worker threads running LP feasibility checks, in submission order.
+
+LPSolver::check_feasibility() reads the orderbooks, so the orderbooks
+must not be modified while any check is in flight.
+*/
+class LPFeasibilityCheckPool : private utils::NonMovableOrCopyable {
+
+	friend class LPFeasibilityCheck;
+
+	//! Checks run concurrently if glpk is built with thread-local 
+	//! environments (see LPSolver).
+	LPSolver& solver;
+
+	std::deque<LPFeasibilityCheck*> queue;
+
+	std::mutex mtx;
+	//! Signals pool threads that the queue is nonempty (or shutdown).
+	std::condition_variable work_cv;
+	//! Signals query threads that a check finished.
+	std::condition_variable done_cv;
+
+	bool shutdown_flag = false;
+
+	std::vector<std::thread> threads;
+
+	void run();
+
+public:
+
+	LPFeasibilityCheckPool(LPSolver& solver, size_t num_threads);
+
+	~LPFeasibilityCheckPool();
+
+	std::unique_ptr<LPFeasibilityCheck> make_check() {
+		return std::make_unique<LPFeasibilityCheck>(*this, solver.make_instance());
+	}
+};
+
+} /* speedex */
@@ -25,6 +25,48 @@
 
 namespace speedex {
 
+namespace {
+
+//! A glpk problem, deleted (in the same thread that created it, 
+//! and so in the same glpk environment) when this leaves scope.
+struct ScopedGLPKProblem {
+	glp_prob* lp;
+
+	ScopedGLPKProblem() : lp(glp_create_prob()) {}
+
+	ScopedGLPKProblem(const ScopedGLPKProblem&) = delete;
+	ScopedGLPKProblem& operator=(const ScopedGLPKProblem&) = delete;
+
+	//! Delete the problem early (i.e. while still holding the glpk lock).
+	void reset() {
+		if (lp != nullptr) {
+			glp_delete_prob(lp);
+			lp = nullptr;
+		}
+	}
+
+	~ScopedGLPKProblem() {
+		reset();
+	}
+};
+
+} /* anonymous namespace */
+
+std::unique_lock<std::mutex> 
+LPSolver::lock_glpk() {
+	if (glpk_thread_local) {
+		return std::unique_lock<std::mutex>();
+	}
+	return std::unique_lock<std::mutex>(mtx);
+}
+
+void
+LPSolver::release_thread_env() {
+	if (glpk_thread_local) {
+		glp_free_env();
+	}
+}
+
 BoundsInfo 
 get_bounds_info(
 	Orderbook& orderbook, 
@@ -114,15 +156,15 @@ bool LPSolver::check_feasibility(
 		bounds.push_back(get_bounds_info(work_unit, prices, approx_params));
 	}
 
-	auto* lp = instance -> lp;
 	auto* ia = instance -> ia;
 	auto* ja = instance -> ja;
 	auto* ar = instance -> ar;
 
 	const size_t nnz = instance -> nnz;
 
-	std::lock_guard lock(mtx); // glp is unfortunately not threadsafe
-	instance->clear();
+	auto lock = lock_glpk();
+	ScopedGLPKProblem problem;
+	auto* lp = problem.lp;
 
 	glp_set_obj_dir(lp, GLP_MAX);
 
@@ -174,14 +216,14 @@ LPSolver::unsafe_check_feasibility(
 	std::vector<BoundsInfo> & info,
 	size_t num_assets)
 {
-	auto* lp = instance -> lp;
 	auto* ia = instance -> ia;
 	auto* ja = instance -> ja;
 	auto* ar = instance -> ar;
 
 	const size_t nnz = instance -> nnz;
 
-	instance->clear();
+	ScopedGLPKProblem problem;
+	auto* lp = problem.lp;
 
 	glp_set_obj_dir(lp, GLP_MAX);
 
@@ -234,9 +276,10 @@ LPSolver::solve(
 		return ClearingParams::get_null_clearing(approx_params.tax_rate, manager.get_orderbooks().size());
 	}
 
-	std::unique_lock lock(mtx);
+	auto lock = lock_glpk();
 
-	glp_prob *lp = glp_create_prob();
+	ScopedGLPKProblem problem;
+	auto* lp = problem.lp;
 	glp_set_obj_dir(lp, GLP_MAX);
 
 	auto& orderbooks = manager.get_orderbooks();
@@ -250,11 +293,12 @@ LPSolver::solve(
 		glp_set_row_bnds(lp, i+1, GLP_LO, 0.0, 0.0);
 	}
 
-	int nnz = 1 + 2 * work_units_sz;
+	LPInstance instance(1 + 2 * work_units_sz);
+	const int nnz = instance.nnz;
 
-	int* ia = new int[nnz];
-	int* ja = new int[nnz];
-	double* ar = new double[nnz];
+	int* ia = instance.ia;
+	int* ja = instance.ja;
+	double* ar = instance.ar;
 
 	// avoid glpk error in case of 1asset simulations (no constraints in such case)
 	if (work_units_sz > 0)
@@ -293,6 +337,7 @@ LPSolver::solve(
 		
 		std::printf("retrying without lower bounds\n");
 
+		problem.reset();
 		lock.unlock();
 		return solve(prices, approx_params, false);
 	}
@@ -339,12 +384,6 @@ LPSolver::solve(
 	delete[] supplies;
 	delete[] demands;
 
-	delete[] ia;
-	delete[] ja;
-	delete[] ar;
-
-	glp_delete_prob(lp);
-
 	return output;
 }
 
@@ -45,13 +45,13 @@ Given a set of prices, solve the trade-maximization lp (or check feasibility).
 
 namespace speedex {
 
-/*! Convenience class around glpk structures for
-one glpk problem instance.
+/*! Workspace (constraint matrix arrays) for building one glpk problem.
 
-Remembers to free problem when this object leaves scope.
-
-Reuses structs from one round to the next.  Take care to call clear() before 
-use.
+Reused from one round to the next.  Used by one thread at a time,
+but may move between threads.  Holds no glpk state: the glpk problem
+itself is created and deleted within each solver call, in the calling 
+thread, as glpk problems cannot move between (thread-local) glpk 
+environments.
 */
 
 class LPInstance {
@@ -60,30 +60,25 @@ class LPInstance {
 	int* ja;
 	double* ar;
 
-	glp_prob* lp;
-	
 	const size_t nnz;
 
 	LPInstance(const size_t nnz) : nnz(nnz) {
 		ia = new int[nnz];
 		ja = new int[nnz];
 		ar = new double[nnz];
-		lp = glp_create_prob();
-	}
-
-	void clear() {
-		glp_erase_prob(lp);
 	}
 
 	friend class LPSolver;
 
 public:
 
+	LPInstance(const LPInstance&) = delete;
+	LPInstance& operator=(const LPInstance&) = delete;
+
 	~LPInstance() {
 		delete[] ia;
 		delete[] ja;
 		delete[] ar;
-		glp_delete_prob(lp);
 	}
 };
 
@@ -95,8 +90,10 @@ struct BoundsInfo {
 
 /*! Constructs and solves instances of the "trade-maximization" linear program.
 
-
-GLPK is NOT threadsafe on its own.  This class is threadsafe.
+This class is threadsafe.  GLPK is only reentrant when built with
+thread-local storage (in which case each thread gets its own glpk 
+environment, and solver calls run concurrently).  Otherwise, 
+calls into glpk are serialized on a mutex.
 */
 class LPSolver {
 
@@ -142,10 +139,21 @@ class LPSolver {
 		FractionalAsset demand, 
 		const uint8_t target_tax);
 
+	//! glpk keeps a separate environment per thread.
+	const bool glpk_thread_local;
+
+	//! Only used if !glpk_thread_local.
 	std::mutex mtx;
 
+	//! Returns a lock on mtx, or an unlocked lock if glpk 
+	//! calls need not be serialized.
+	std::unique_lock<std::mutex> lock_glpk();
+
 public:
-	LPSolver(OrderbookManager& manager) : manager(manager) {}
+	LPSolver(OrderbookManager& manager) 
+		: manager(manager)
+		, glpk_thread_local(glp_config("TLS") != NULL)
+		, mtx() {}
 
 	//! Solve the LP at input prices.
 	ClearingParams 
@@ -173,6 +181,28 @@ public:
 
 	//! Produce a new lp solver instance.
 	std::unique_ptr<LPInstance> make_instance() const;
+
+	//! Free the calling thread's glpk environment.  Call when a 
+	//! thread that used the solver exits.  No-op unless glpk
+	//! environments are thread-local.
+	void release_thread_env();
+};
+
+//! Calls LPSolver::release_thread_env() when the owning thread
+//! leaves the scope (however it exits).
+class LPThreadEnvGuard {
+	LPSolver& solver;
+
+public:
+	explicit LPThreadEnvGuard(LPSolver& solver)
+		: solver(solver) {}
+
+	LPThreadEnvGuard(const LPThreadEnvGuard&) = delete;
+	LPThreadEnvGuard& operator=(const LPThreadEnvGuard&) = delete;
+
+	~LPThreadEnvGuard() {
+		solver.release_thread_env();
+	}
 };
 
 }
@@ -0,0 +1,137 @@
+#pragma once
+
+/**
+ * SPEEDEX: A Scalable, Parallelizable, and Economically Efficient Decentralized Exchange
+ * Copyright (C) 2023 Geoffrey Ramseyer
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*! \file split_accumulator.h
+
+Per-asset 128-bit supply/demand accumulators, stored as
+separate low and high 64-bit lanes.
+*/
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+namespace speedex {
+
+/*! A vector of unsigned 128-bit accumulators, as two arrays of 64-bit
+lanes (structure-of-arrays), so that lane-wise merges of whole vectors
+vectorize.
+
+Values are exactly those of uint128_t arithmetic, except that
+overflow past 2^128 (or, for sub(), below 0) sets a sticky flag
+instead of silently wrapping.  Call check_overflow() before using
+results.
+*/
+class SplitAccumulatorVector {
+
+	using uint128_t = __uint128_t;
+
+	std::vector<uint64_t> lo;
+	std::vector<uint64_t> hi;
+
+	bool overflow = false;
+
+public:
+
+	SplitAccumulatorVector(size_t size = 0)
+		: lo(size, 0)
+		, hi(size, 0)
+		{}
+
+	void resize(size_t size) {
+		lo.assign(size, 0);
+		hi.assign(size, 0);
+		overflow = false;
+	}
+
+	size_t size() const {
+		return lo.size();
+	}
+
+	//! Zero all accumulators and clear the overflow flag.
+	void clear() {
+		std::fill(lo.begin(), lo.end(), 0);
+		std::fill(hi.begin(), hi.end(), 0);
+		overflow = false;
+	}
+
+	void add(size_t idx, uint128_t value) {
+		uint64_t value_lo = static_cast<uint64_t>(value);
+		uint64_t value_hi = static_cast<uint64_t>(value >> 64);
+
+		uint64_t carry = __builtin_add_overflow(lo[idx], value_lo, &lo[idx]);
+		overflow |= __builtin_add_overflow(hi[idx], value_hi, &hi[idx]);
+		overflow |= __builtin_add_overflow(hi[idx], carry, &hi[idx]);
+	}
+
+	void sub(size_t idx, uint128_t value) {
+		uint64_t value_lo = static_cast<uint64_t>(value);
+		uint64_t value_hi = static_cast<uint64_t>(value >> 64);
+
+		uint64_t borrow = __builtin_sub_overflow(lo[idx], value_lo, &lo[idx]);
+		overflow |= __builtin_sub_overflow(hi[idx], value_hi, &hi[idx]);
+		overflow |= __builtin_sub_overflow(hi[idx], borrow, &hi[idx]);
+	}
+
+	//! Lane-wise add.  Sizes must match.
+	void add(const SplitAccumulatorVector& other) {
+		const size_t sz = size();
+		uint64_t* __restrict__ lo_out = lo.data();
+		uint64_t* __restrict__ hi_out = hi.data();
+		const uint64_t* __restrict__ lo_in = other.lo.data();
+		const uint64_t* __restrict__ hi_in = other.hi.data();
+
+		bool local_overflow = other.overflow;
+		for (size_t i = 0; i < sz; i++) {
+			uint64_t new_lo = lo_out[i] + lo_in[i];
+			uint64_t carry = new_lo < lo_in[i];
+			uint64_t new_hi = hi_out[i] + hi_in[i] + carry;
+			// overflowed iff the true high sum exceeds 64 bits
+			local_overflow |= (new_hi < hi_in[i]) | ((new_hi == hi_in[i]) & (carry | (hi_out[i] != 0)));
+			lo_out[i] = new_lo;
+			hi_out[i] = new_hi;
+		}
+		overflow |= local_overflow;
+	}
+
+	uint128_t get(size_t idx) const {
+		return (static_cast<uint128_t>(hi[idx]) << 64) + lo[idx];
+	}
+
+	//! out[i] = get(i)
+	void write_to(uint128_t* out) const {
+		for (size_t i = 0; i < size(); i++) {
+			out[i] = get(i);
+		}
+	}
+
+	bool overflowed() const {
+		return overflow;
+	}
+
+	void check_overflow() const {
+		if (overflow) {
+			throw std::runtime_error("supply/demand accumulator overflow");
+		}
+	}
+};
+
+} /* speedex */
@@ -25,6 +25,7 @@
 
 #include "speedex/speedex_static_configs.h"
 
+#include <algorithm>
 #include <cmath>
 
 namespace speedex {
@@ -145,7 +146,10 @@ void TatonnementOracle::run_tatonnement_thread(TatonnementControlParameters* con
 
 	auto& control_params = *control_params_ptr;
 
-	std::unique_ptr<LPInstance> instance = solver.make_instance();
+	// solve() below runs glpk on this thread.
+	LPThreadEnvGuard env_guard(solver);
+
+	auto lp_check = lp_check_pool.make_check();
 
 	while(true) {
 		std::unique_lock lock(mtx);
@@ -157,23 +161,23 @@ void TatonnementOracle::run_tatonnement_thread(TatonnementControlParameters* con
 		for(size_t i = 0; i < num_assets; i++) {
 			local_price_workspace[i] = internal_shared_price_workspace[i];
 		}
+		bool resume = warm_start && previous_query_cleared;
 
 		if (kill_threads_flag) return;
 		num_active_threads ++;
 		lock.unlock();
 
-		#ifdef USE_DEMAND_MULT_PRICES
-			auto success = better_grid_search_tatonnement_query(control_params, local_price_workspace.data(), instance);
-		#else 
-			auto success = grid_search_tatonnement_query(control_params, local_price_workspace.data(), instance);
-		#endif
+		auto success = better_grid_search_tatonnement_query(control_params, local_price_workspace.data(), *lp_check, resume);
 
 		lock.lock();
 		num_active_threads --;
 
+		control_params.queries_since_assignment++;
+
 		if (success && !found_success)
 		{
 			found_success = true;
+			clearing_config = control_params.config_idx;
 			for(size_t i = 0; i < num_assets; i++) {
 				internal_shared_price_workspace[i] = local_price_workspace[i];	
 			}
@@ -190,6 +194,7 @@ void TatonnementOracle::run_tatonnement_thread(TatonnementControlParameters* con
 			if ((current_best_utility_ratio < 0) || (my_utility_ratio < current_best_utility_ratio))
 			{
 				current_best_utility_ratio = lost/sat;
+				best_loss_config = control_params.config_idx;
 				for(size_t i = 0; i < num_assets; i++) {
 					internal_shared_price_workspace[i] = local_price_workspace[i];	
 				}
@@ -216,52 +221,159 @@ void TatonnementOracle::run_tatonnement_thread(TatonnementControlParameters* con
 	}
 }
 
-void TatonnementOracle::start_tatonnement_threads() {
-	size_t num_work_units = get_num_orderbooks_by_asset_count(num_assets);
+int32_t
+TatonnementOracle::find_configuration(
+	int step_radix, bool use_volume_relativizer, bool use_jacobian_preconditioner) const {
+	for (size_t i = 0; i < portfolio.size(); i++) {
+		if (portfolio[i].step_radix == step_radix 
+			&& portfolio[i].use_volume_relativizer == use_volume_relativizer
+			&& portfolio[i].use_jacobian_preconditioner == use_jacobian_preconditioner) {
+			return i;
+		}
+	}
+	return -1;
+}
 
-	bool first = true;
+void
+TatonnementOracle::assign_configuration(TatonnementControlParameters& params, size_t config_idx) {
+	auto const& config = portfolio.at(config_idx);
+	params.step_radix = config.step_radix;
+	params.use_volume_relativizer = config.use_volume_relativizer;
+	params.use_jacobian_preconditioner = config.use_jacobian_preconditioner;
+	params.config_idx = config_idx;
+	params.queries_since_assignment = 0;
+	// step sizes are relative to step_radix, so don't carry over
+	params.resume_step = 0;
+}
 
-	for (size_t i = 0; i < 3 ; i++) {
+void TatonnementOracle::start_tatonnement_threads() {
+	size_t num_work_units = get_num_orderbooks_by_asset_count(num_assets);
 
-		auto params = new TatonnementControlParameters(num_assets, num_work_units);
-		if (params == nullptr) {
-			throw std::runtime_error("nonsense");
+	for (size_t j = 0; j < 2; j++) {
+		for (size_t v = 0; v < 2; v++) {
+			for (size_t i = 0; i < PORTFOLIO_NUM_RADIXES; i++) {
+				portfolio.push_back(TatonnementConfiguration{
+					static_cast<uint8_t>(PORTFOLIO_MAX_STEP_RADIX - PORTFOLIO_RADIX_SPACING * i),
+					v == 1,
+					j == 1});
+			}
 		}
+	}
+
+	for (size_t t = 0; t < NUM_WORKER_THREADS; t++) {
+		auto params = new TatonnementControlParameters(num_assets, num_work_units, demand_pool);
 		
 		params->min_step = ((uint64_t)1) << 7; // 7
 		params->step_adjust_radix = 5; // 5
+		params->diff_reduction = 0;
+		params->use_dynamic_relativizer = true;
 
-		params->step_radix = 110 - 16*i;
-		params->diff_reduction = 0;//5*(3-i);
-		//params->use_in_case_of_timeout = first; // only one thread should be set to true.
-		first = false;
-
-		params -> use_dynamic_relativizer = true;
+		// Start with step_radix = 110 - 16*i (i < 3), 
+		// with and without volume relativizers.
+		int32_t config = find_configuration(110 - 16 * (t % 3), t >= 3, false);
+		if (config < 0) {
+			throw std::runtime_error("initial tatonnement configuration not in portfolio");
+		}
+		assign_configuration(*params, config);
 
+		thread_params.push_back(params);
 		worker_threads.emplace_back(std::thread(
-			[this] (TatonnementControlParameters* params) {
+			[this, params] {
 				run_tatonnement_thread(params);
-			}, params));
+			}));
 	}
-	for (size_t i = 0; i < 3; i++) {
-		auto params = new TatonnementControlParameters(num_assets, num_work_units);
+}
 
-		params -> min_step = ((uint64_t)1)<<7;
-		params->step_adjust_radix = 5;
+void TatonnementOracle::record_query_winner() {
+	std::lock_guard lock(mtx);
 
-		params -> step_radix = 110-16*i;
-		params->diff_reduction = 0;
-		//params->use_in_case_of_timeout = false;
+	int32_t winner = found_success ? clearing_config : best_loss_config;
+	recent_winners.push_back(winner);
+	if (recent_winners.size() > PORTFOLIO_WINDOW) {
+		recent_winners.pop_front();
+	}
 
-		params->use_volume_relativizer = true;
-		params->use_dynamic_relativizer = true;
+	auto& stats = portfolio_stats.configuration_stats;
+	stats.clear();
+	for (auto const& config : portfolio) {
+		TatonnementConfigurationStats config_stats;
+		config_stats.step_radix = config.step_radix;
+		config_stats.use_volume_relativizer = config.use_volume_relativizer ? 1 : 0;
+		config_stats.use_jacobian_preconditioner = config.use_jacobian_preconditioner ? 1 : 0;
+		config_stats.num_threads = 0;
+		config_stats.window_wins = 0;
+		stats.push_back(config_stats);
+	}
+	for (auto const* params : thread_params) {
+		stats[params->config_idx].num_threads++;
+	}
+	for (auto w : recent_winners) {
+		if (w >= 0) {
+			stats[w].window_wins++;
+		}
+	}
+	portfolio_stats.winning_configuration = winner;
+}
 
-		worker_threads.emplace_back(std::thread(
-			[this, params] {
-				run_tatonnement_thread(params);
-			}));
+void TatonnementOracle::reallocate_configurations() {
+	if (recent_winners.size() < PORTFOLIO_MIN_SAMPLES) {
+		return;
 	}
 
+	std::vector<size_t> wins(portfolio.size(), 0);
+	for (auto w : recent_winners) {
+		if (w >= 0) {
+			wins[w]++;
+		}
+	}
+	std::vector<bool> covered(portfolio.size(), false);
+	for (auto const* params : thread_params) {
+		covered[params->config_idx] = true;
+	}
+
+	// Only threads that had a whole window to win are moved.
+	TatonnementControlParameters* loser = nullptr;
+	for (auto* params : thread_params) {
+		if (wins[params->config_idx] == 0 
+			&& params->queries_since_assignment >= PORTFOLIO_WINDOW) {
+			loser = params;
+			break;
+		}
+	}
+	if (loser == nullptr) {
+		return;
+	}
+
+	std::vector<size_t> ranked(portfolio.size());
+	for (size_t i = 0; i < ranked.size(); i++) {
+		ranked[i] = i;
+	}
+	std::stable_sort(ranked.begin(), ranked.end(),
+		[&wins] (size_t a, size_t b) {
+			return wins[a] > wins[b];
+		});
+
+	for (size_t c : ranked) {
+		if (wins[c] == 0) {
+			return;
+		}
+		auto const& config = portfolio[c];
+		const bool vol = config.use_volume_relativizer;
+		const bool jac = config.use_jacobian_preconditioner;
+		int32_t neighbours[4] = {
+			find_configuration(config.step_radix + PORTFOLIO_RADIX_SPACING, vol, jac),
+			find_configuration(config.step_radix - PORTFOLIO_RADIX_SPACING, vol, jac),
+			find_configuration(config.step_radix, !vol, jac),
+			find_configuration(config.step_radix, vol, !jac)
+		};
+		for (auto n : neighbours) {
+			if (n >= 0 && !covered[n]) {
+				TAT_INFO("moving tatonnement thread from config %lu to %d", loser->config_idx, n);
+				assign_configuration(*loser, n);
+				return;
+			}
+		}
+	}
 }
 
 void TatonnementOracle::end_tatonnement_threads() {
@@ -274,6 +386,7 @@ void TatonnementOracle::end_tatonnement_threads() {
 	for (size_t i = 0; i < worker_threads.size(); i++) {
 		worker_threads[i].join();
 	}
+	thread_params.clear();
 }
 
 void TatonnementOracle::start_tatonnement_query() {
@@ -283,7 +396,14 @@ void TatonnementOracle::start_tatonnement_query() {
 	timeout_happened = false;
 	
 	current_best_utility_ratio = -1;
+	previous_query_cleared = found_success;
 	found_success = false;
+	clearing_config = -1;
+	best_loss_config = -1;
+
+	if (num_active_threads == 0) {
+		reallocate_configurations();
+	}
 	
 	start_cv.notify_all();
 }
@@ -359,6 +479,7 @@ TatonnementOracle::compute_prices_grid_search(Price* prices_workspace, const App
 
 	start_tatonnement_query();
 	finish_tatonnement_query();
+	record_query_winner();
 	for (size_t i = 0; i < num_assets; i++) {
 		prices_workspace[i] = internal_shared_price_workspace[i];
 	}
@@ -423,7 +544,8 @@ void set_relativizers(
 	const uint16_t* volume_relativizers, 
 	size_t num_assets, 
 	const uint128_t* demands, 
-	const uint128_t* supplies)
+	const uint128_t* supplies,
+	const std::vector<double>& jacobian_diagonal)
 {
 	uint128_t max_min_demand = 0;
 	for (size_t i = 0; i < num_assets; i++) {
@@ -438,6 +560,25 @@ void set_relativizers(
 		return (b > UINT16_MAX)? UINT16_MAX : b;
 	};
 
+	if (control_params.use_jacobian_preconditioner 
+		&& jacobian_diagonal.size() == num_assets) {
+		// Jacobi preconditioning: step each price inversely
+		// to its excess demand's sensitivity to that price.
+		double max_diag = 0;
+		for (size_t i = 0; i < num_assets; i++) {
+			max_diag = std::max(max_diag, jacobian_diagonal[i]);
+		}
+		for (size_t i = 0; i < num_assets; i++) {
+			uint16_t base_vol_rel = control_params.use_volume_relativizer ? volume_relativizers[i] : 1;
+			if (jacobian_diagonal[i] <= 0) {
+				relativizers_out[i] = impose_max(MAX_MUL, base_vol_rel);
+			} else {
+				relativizers_out[i] = impose_max(max_diag / jacobian_diagonal[i], base_vol_rel);
+			}
+		}
+		return;
+	}
+
 	for (size_t i = 0; i < num_assets; i++) {
 		uint128_t cur_min_demand = std::min(demands[i], supplies[i]);
 		uint16_t base_vol_rel = control_params.use_volume_relativizer ? volume_relativizers[i] : 1;
@@ -458,7 +599,8 @@ bool
 TatonnementOracle::better_grid_search_tatonnement_query(
 	TatonnementControlParameters& control_params,
 	Price* prices_workspace,
-	std::unique_ptr<LPInstance>& lp_instance)
+	LPFeasibilityCheck& lp_check,
+	bool resume)
 {
 
 	#ifndef USE_DEMAND_MULT_PRICES
@@ -473,6 +615,10 @@ TatonnementOracle::better_grid_search_tatonnement_query(
 
 	uint64_t step = min_step;// 1/2^value
 
+	if (resume && control_params.resume_step > 0) {
+		step = std::max(min_step, control_params.resume_step >> WARM_START_STEP_BACKOFF);
+	}
+
 	const uint8_t step_adjust_radix = control_params.step_adjust_radix;
 	
 	const uint16_t step_up = (uint16_t) (1.4 * ((double) (((uint16_t)1) << step_adjust_radix)));
@@ -490,12 +636,25 @@ TatonnementOracle::better_grid_search_tatonnement_query(
 
 	uint16_t* relativizers = new uint16_t[num_assets];
 
+	MultiPriceQueryWorkspace step_candidates(num_assets, STEP_SEARCH_WIDTH);
+	uint64_t candidate_steps[STEP_SEARCH_WIDTH];
+	bool candidate_changes[STEP_SEARCH_WIDTH];
+
+	// Whether the last round's step was rejected.
+	bool backtracking = false;
+
 	for (size_t i = 0; i < num_assets; i++) {
 		relativizers[i] = volume_relativizers[i];
 	}
 
+	std::vector<double> jacobian_diagonal;
+
+	auto save_resume_state = [&] () {
+		control_params.resume_step = step;
+	};
+
 	auto& demand_oracle = *(control_params.oracle);
-	demand_oracle.activate_oracle();
+	demand_oracle.activate_oracle(work_units, work_unit_manager.get_numa_node_bounds());
 
 	demand_oracle.
 		get_supply_demand(prices_workspace, supplies_search, demands_search, work_units, active_approx_params.smooth_mult);//, function_inputs);
@@ -509,14 +668,25 @@ TatonnementOracle::better_grid_search_tatonnement_query(
 
 	int force_step_rounds = 0;
 
+	// Prices to output on clearing.  Either trial_prices (when
+	// check_clearing() passes this round), or exactly the price vector
+	// that an LP feasibility check verified (a copy of trial_prices from
+	// the round it was submitted, possibly several rounds ago).  Never
+	// the current trial_prices on the strength of an older check.
+	const Price* clearing_prices = trial_prices;
+
 	while (true) {
 
 		if (round_number % LP_CHECK_FREQ == LP_CHECK_FREQ - 1) {
-			TAT_INFO_F(auto timestamp = utils::init_time_measurement());
-			auto solver_res = solver.check_feasibility(trial_prices, lp_instance, active_approx_params);
-			if (solver_res) {
+			lp_check.try_submit(trial_prices, num_assets, active_approx_params);
+		}
+
+		if (!clearing) {
+			auto solver_res = lp_check.poll();
+			if (solver_res && *solver_res) {
 				clearing = true;
-				TAT_INFO("clearing because lp solver found valid solution: lp time %lf", utils::measure_time(timestamp));
+				clearing_prices = lp_check.get_checked_prices().data();
+				TAT_INFO("clearing because lp solver found valid solution");
 			}
 		}
 
@@ -544,12 +714,20 @@ TatonnementOracle::better_grid_search_tatonnement_query(
 						delta);
 				}
 				TAT_INFO("tax_rate %lu smooth_mult %lu", active_approx_params.tax_rate, active_approx_params.smooth_mult);
+				TAT_INFO_F(
+					auto share_times = demand_oracle.get_share_compute_times();
+					for (size_t i = 0; i < share_times.size(); i++) {
+						TAT_INFO("demand oracle share %lu compute time %lf", i, share_times[i]);
+					}
+				);
 				for (size_t i = 0; i < num_assets; i++) {
-					prices_workspace[i] = trial_prices[i];
+					prices_workspace[i] = clearing_prices[i];
 				}
 				internal_measurements.num_rounds = round_number;
 				internal_measurements.step_radix = step_radix;
 			}
+			save_resume_state();
+			lp_check.wait();
 			delete[] trial_prices;
 			delete[] supplies_workspace;
 			delete[] demands_workspace;
@@ -563,30 +741,72 @@ TatonnementOracle::better_grid_search_tatonnement_query(
 		round_number++;
 
 		if (round_number % 10 == 9) {
-			set_relativizers(control_params, relativizers, volume_relativizers, num_assets, demands_search, supplies_search);
+			if (control_params.use_jacobian_preconditioner) {
+				demand_oracle.get_jacobian_diagonal(
+					prices_workspace, work_units, active_approx_params.smooth_mult, jacobian_diagonal);
+			}
+			set_relativizers(control_params, relativizers, volume_relativizers, num_assets, demands_search, supplies_search, jacobian_diagonal);
 			prev_objective.eval(supplies_workspace, demands_workspace, prices_workspace, relativizers, num_assets);
 		}
 
 
-		bool any_change = set_trial_prices(prices_workspace, trial_prices, step, control_params, demands_search, supplies_search, relativizers);
+		bool any_change;
+		MultifuncTatonnementObjective new_objective;
+
+		if (backtracking && force_step_rounds == 0) {
+			// Try this step and the next smaller ones at once, and take 
+			// the first that the one-step-per-round search would accept
+			// (or the smallest, if none would be).
+			uint64_t candidate_step = step;
+			for (size_t k = 0; k < STEP_SEARCH_WIDTH; k++) {
+				candidate_steps[k] = candidate_step;
+				candidate_changes[k] = set_trial_prices(prices_workspace, step_candidates.get_prices(k), candidate_step, control_params, demands_search, supplies_search, relativizers);
+				candidate_step = decrement_step(candidate_step, step_down, step_adjust_radix);
+			}
+
+			step_candidates.query(demand_oracle, work_units, active_approx_params.smooth_mult);
+
+			size_t chosen = STEP_SEARCH_WIDTH - 1;
+			for (size_t k = 0; k < STEP_SEARCH_WIDTH; k++) {
+				new_objective.eval(step_candidates.get_supplies(k), step_candidates.get_demands(k), prices_workspace, relativizers, num_assets);
+				if (new_objective.is_better_than(prev_objective) 
+					|| candidate_steps[k] < min_step 
+					|| !candidate_changes[k]
+					|| check_clearing(step_candidates.get_demands(k), step_candidates.get_supplies(k), active_approx_params.tax_rate, num_assets)) {
+					chosen = k;
+					break;
+				}
+			}
+
+			step = candidate_steps[chosen];
+			any_change = candidate_changes[chosen];
+			for (size_t i = 0; i < num_assets; i++) {
+				trial_prices[i] = step_candidates.get_prices(chosen)[i];
+				supplies_workspace[i] = step_candidates.get_supplies(chosen)[i];
+				demands_workspace[i] = step_candidates.get_demands(chosen)[i];
+			}
+		} else {
+			any_change = set_trial_prices(prices_workspace, trial_prices, step, control_params, demands_search, supplies_search, relativizers);
+
+			clear_supply_demand_workspaces(supplies_workspace, demands_workspace);
+
+			demand_oracle.
+				get_supply_demand(trial_prices, supplies_workspace, demands_workspace, work_units, active_approx_params.smooth_mult);
+
+			new_objective.eval(supplies_workspace, demands_workspace, prices_workspace, relativizers, num_assets);
+		}
 
 		if (!any_change) {
 			force_step_rounds = 10;
 		}
 
-		clear_supply_demand_workspaces(supplies_workspace, demands_workspace);
-
-		demand_oracle.
-			get_supply_demand(trial_prices, supplies_workspace, demands_workspace, work_units, active_approx_params.smooth_mult);
-
 		clearing = check_clearing(demands_workspace, supplies_workspace, active_approx_params.tax_rate, num_assets);
 
-		MultifuncTatonnementObjective new_objective;
-		new_objective.eval(supplies_workspace, demands_workspace, prices_workspace, relativizers, num_assets);
-
 		if (round_number % 10000 == 9999) {
 			auto other_finisher = done_tatonnement_flag.load(std::memory_order_acquire);
 			if (other_finisher) {
+				save_resume_state();
+				lp_check.wait();
 				delete[] trial_prices;
 				delete[] supplies_workspace;
 				delete[] demands_workspace;
@@ -633,8 +853,10 @@ TatonnementOracle::better_grid_search_tatonnement_query(
 			}
 			prev_objective = new_objective;
 			step = increment_step(step, step_up, step_adjust_radix);
+			backtracking = false;
 		} else {
 			step = decrement_step(step, step_down, step_adjust_radix);
+			backtracking = true;
 		}
 
 		if (round_number % 1000 == 0) {
@@ -27,17 +27,21 @@ Run Tatonnement in one interface.
 #include <cstdint>
 
 #include <atomic>
+#include <deque>
 #include <mutex>
 #include <condition_variable>
 #include <thread>
+#include <vector>
 
 
 #include "orderbook/orderbook_manager.h"
 
 #include "price_computation/demand_oracle.h"
+#include "price_computation/lp_check_pool.h"
 #include "price_computation/lp_solver.h"
 
 #include "speedex/approximation_parameters.h"
+#include "speedex/speedex_static_configs.h"
 
 #include "utils/price.h"
 
@@ -52,7 +56,7 @@ typedef unsigned __int128 uint128_t;
 //! Various control parameters guiding a Tatonnement run.
 struct TatonnementControlParameters {
 
-	constexpr static size_t NUM_DEMAND_WORKERS = 5;
+	constexpr static size_t NUM_DEMAND_SHARES = 6;
 
 	uint8_t step_radix = 55; // 50 //33
 	uint64_t min_step = ((uint64_t)1)<<7;
@@ -61,10 +65,23 @@ struct TatonnementControlParameters {
 	//bool use_in_case_of_timeout = false;
 	bool use_volume_relativizer = false;
 	bool use_dynamic_relativizer = false;
-	std::optional<ParallelDemandOracle<NUM_DEMAND_WORKERS>> oracle;
-
-	TatonnementControlParameters(size_t num_assets, size_t num_work_units)
-		: oracle(std::make_optional<ParallelDemandOracle<NUM_DEMAND_WORKERS>>(num_work_units, num_assets)) {}
+	//! Scale each asset's step by the inverse of its estimated
+	//! excess demand sensitivity (the Jacobian's diagonal), instead
+	//! of by the dynamic relativizer.
+	bool use_jacobian_preconditioner = false;
+	std::optional<ParallelDemandOracle<NUM_DEMAND_SHARES>> oracle;
+
+	//! Step size at the end of the last query (0 if none),
+	//! for warm starting the next one.
+	uint64_t resume_step = 0;
+
+	//! Index of these params' configuration in the oracle's portfolio.
+	size_t config_idx = 0;
+	//! Queries run since the configuration was (re)assigned.
+	size_t queries_since_assignment = 0;
+
+	TatonnementControlParameters(size_t num_assets, size_t num_work_units, DemandWorkerPool& pool)
+		: oracle(std::in_place, num_work_units, num_assets, pool) {}
 };
 
 //! The objective function guiding Tatonnement's step size.
@@ -105,6 +122,14 @@ struct MultifuncTatonnementObjective {
 };
 
 
+//! A point in the control parameter space searched by the
+//! Tatonnement query threads.
+struct TatonnementConfiguration {
+	uint8_t step_radix;
+	bool use_volume_relativizer;
+	bool use_jacobian_preconditioner;
+};
+
 /*! 
 
 Operates as an oracle for price computation via Tatonnement.
@@ -124,9 +149,45 @@ class TatonnementOracle {
 	size_t num_assets;
 	ApproximationParameters active_approx_params;
 
+	//! Demand computation threads, shared by all the Tatonnement threads.
+	DemandWorkerPool demand_pool;
+
+	//! LP feasibility check threads, shared by all the Tatonnement threads.
+	LPFeasibilityCheckPool lp_check_pool;
+
 	//! Run Tatonnement with multiple control param settings in these threads.
 	std::vector<std::thread> worker_threads;
 
+	//! Control params of each worker thread (owned by the thread).
+	std::vector<TatonnementControlParameters*> thread_params;
+
+	//! Configurations that worker threads can be assigned.
+	std::vector<TatonnementConfiguration> portfolio;
+
+	//! Winning configuration (portfolio index, or -1) of each of the
+	//! last (up to) PORTFOLIO_WINDOW queries.
+	std::deque<int32_t> recent_winners;
+
+	//! First configuration to clear in the current query.
+	int32_t clearing_config = -1;
+	//! Configuration with the lowest utility loss so far in the
+	//! current query (the winner if none clears).
+	int32_t best_loss_config = -1;
+
+	constexpr static size_t NUM_WORKER_THREADS = 6;
+
+	constexpr static uint8_t PORTFOLIO_MAX_STEP_RADIX = 110;
+	constexpr static uint8_t PORTFOLIO_RADIX_SPACING = 8;
+	constexpr static size_t PORTFOLIO_NUM_RADIXES = 7;
+
+	constexpr static size_t PORTFOLIO_WINDOW = 32;
+	//! Don't reallocate threads until the window has this many queries.
+	constexpr static size_t PORTFOLIO_MIN_SAMPLES = 8;
+
+	static_assert(PORTFOLIO_MAX_STEP_RADIX 
+		>= PORTFOLIO_RADIX_SPACING * (PORTFOLIO_NUM_RADIXES - 1),
+		"negative step_radix in portfolio");
+
 	std::atomic_bool done_tatonnement_flag = true;
 
 	std::atomic_bool timeout_happened = false;
@@ -145,14 +206,38 @@ class TatonnementOracle {
 
 	TatonnementMeasurements internal_measurements;
 
+	//! Configuration statistics as of the last query.
+	TatonnementPortfolioStats portfolio_stats;
+
 	double current_best_utility_ratio = -1;
 	bool found_success = false;
 
+	//! Resume each query thread's step size from the previous query,
+	//! reduced by WARM_START_STEP_BACKOFF.  Relativizers restart.
+	//! The resumed steps (like recent_winners and the thread
+	//! assignment) are only kept in memory, so after a restart
+	//! the first query starts cold.
+	bool warm_start = true;
+	//! Whether the previous query found clearing prices (if not,
+	//! its step schedule is not worth resuming).
+	bool previous_query_cleared = false;
+
+	//! A resumed step size is divided by 2^WARM_START_STEP_BACKOFF,
+	//! in case the market moved since the previous query.
+	constexpr static uint8_t WARM_START_STEP_BACKOFF = 2;
+
+	//! Submit an LP feasibility check (if the thread has none in
+	//! flight) every LP_CHECK_FREQ rounds.
 	constexpr static size_t LP_CHECK_FREQ = 1000;
 
 	static_assert(LP_CHECK_FREQ >= 2,
 		"too small, can't check lp on round 0 (trial_prices unset)");
 
+	//! After a rejected step, the next round evaluates this many
+	//! successively smaller steps in one multi-vector demand query,
+	//! instead of one step per round.
+	constexpr static size_t STEP_SEARCH_WIDTH = 4;
+
 /*
 	long double get_objective(
 		const uint128_t* supplies,
@@ -182,6 +267,21 @@ class TatonnementOracle {
 
 	void clear_supply_demand_workspaces(uint128_t* supplies, uint128_t* demands);
 
+	//! Portfolio index of a configuration (or -1 if none matches).
+	int32_t find_configuration(
+		int step_radix, bool use_volume_relativizer, bool use_jacobian_preconditioner) const;
+
+	void assign_configuration(TatonnementControlParameters& params, size_t config_idx);
+
+	//! Record the winner of the query that just finished, and
+	//! export window statistics to portfolio_stats.
+	void record_query_winner();
+
+	//! Move at most one thread, whose configuration has not won
+	//! recently, to a neighbour of the most successful configuration.
+	//! Call only while no query threads are running.
+	void reallocate_configurations();
+
 	//! Create Tatonnement threads.
 	void start_tatonnement_threads();
 	//! Signal tatonnement threads to shut down.  Joins these threads.
@@ -197,10 +297,13 @@ class TatonnementOracle {
 
 	//! Run one Tatonnement query with a given set of control params.
 	//! return true if this thread is the first to find successful equilibrium
+	//! If \a resume is set, starts from the step size that the last
+	//! query with these control params ended with.
 	bool better_grid_search_tatonnement_query(
 		TatonnementControlParameters& control_params, 
 		Price* prices_workspace, 
-		std::unique_ptr<LPInstance>& lp_instance);
+		LPFeasibilityCheck& lp_check,
+		bool resume);
 	
 public:
 	TatonnementOracle(
@@ -209,7 +312,8 @@ public:
 	: work_unit_manager(work_unit_manager)
 	, solver(solver)
 	, num_assets(work_unit_manager.get_num_assets())
-
+	, demand_pool(NUM_DEMAND_POOL_THREADS, DEMAND_POOL_FIRST_CORE, NUMA_AWARE_PLACEMENT)
+	, lp_check_pool(solver, NUM_LP_CHECK_THREADS)
 	{
 		internal_shared_price_workspace = new Price[num_assets];
 		volume_relativizers = new uint16_t[num_assets];
@@ -233,6 +337,19 @@ public:
 		const ApproximationParameters approx_params, 
 		const uint16_t* v_relativizers = nullptr);
 	
+	//! Winning configuration and per-configuration statistics
+	//! as of the last query.
+	//! Call only when no query is running.
+	const TatonnementPortfolioStats& get_portfolio_stats() const {
+		return portfolio_stats;
+	}
+
+	//! Turn warm starting (on by default) on or off.
+	//! Call only when no query is running.
+	void set_warm_start(bool enable) {
+		warm_start = enable;
+	}
+
 	//! Wait for all running tatonnement query threads to finish their queries,
 	//! typically by waiting for them to read a timeout signal or a signal
 	//! that some other thread finished a query first.
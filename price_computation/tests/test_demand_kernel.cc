@@ -0,0 +1,376 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "orderbook/orderbook_manager.h"
+#include "orderbook/orderbook_manager_view.h"
+#include "orderbook/utils.h"
+
+#include "price_computation/demand_kernel.h"
+#include "price_computation/demand_oracle.h"
+#include "price_computation/demand_worker_pool.h"
+
+#include "utils/price.h"
+
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+namespace speedex
+{
+
+namespace {
+
+void make_random_orderbooks(OrderbookManager& manager, uint16_t num_assets, std::minstd_rand& gen)
+{
+	std::uniform_int_distribution<uint64_t> amount_dist(1, 1'000'000);
+	std::uniform_real_distribution<double> price_dist(0.1, 10);
+
+	int x = 0;
+	uint64_t offer_id = 0;
+
+	ProcessingSerialManager serial_manager(manager);
+
+	for (size_t idx = 0; idx < manager.get_num_orderbooks(); idx++) {
+		auto category = category_from_idx(idx, num_assets);
+		for (int i = 0; i < 50; i++) {
+			Offer offer;
+			offer.category = category;
+			offer.offerId = offer_id++;
+			offer.owner = 1;
+			offer.amount = amount_dist(gen);
+			offer.minPrice = price::from_double(price_dist(gen));
+
+			serial_manager.add_offer(idx, offer, x, x);
+		}
+	}
+	serial_manager.finish_merge();
+
+	manager.commit_for_production(1);
+}
+
+} /* anonymous namespace */
+
+TEST_CASE("batched demand kernel matches per-orderbook path", "[price_computation]")
+{
+	const uint16_t num_assets = 10;
+
+	std::minstd_rand gen(0);
+	std::uniform_real_distribution<double> price_dist(0.5, 2);
+
+	OrderbookManager manager(num_assets);
+	make_random_orderbooks(manager, num_assets, gen);
+
+	auto& orderbooks = manager.get_orderbooks();
+	const size_t num_orderbooks = orderbooks.size();
+
+	DemandKernel kernel;
+
+	for (uint8_t smooth_mult : {0, 2, 5, 10}) {
+		for (int trial = 0; trial < 20; trial++) {
+			std::vector<Price> prices(num_assets);
+			for (auto& p : prices) {
+				p = price::from_double(price_dist(gen));
+			}
+
+			std::vector<uint128_t> expect_supplies(num_assets, 0), expect_demands(num_assets, 0);
+			std::vector<uint128_t> supplies(num_assets, 0), demands(num_assets, 0);
+
+			for (auto& orderbook : orderbooks) {
+				orderbook.calculate_demands_and_supplies_times_prices(
+					prices.data(), expect_demands.data(), expect_supplies.data(), smooth_mult);
+			}
+
+			// split so that batches do not line up with the range
+			size_t split = num_orderbooks / 3;
+			kernel.compute(prices.data(), demands.data(), supplies.data(), orderbooks, 0, split, smooth_mult);
+			kernel.compute(prices.data(), demands.data(), supplies.data(), orderbooks, split, num_orderbooks, smooth_mult);
+
+			for (size_t i = 0; i < num_assets; i++) {
+				REQUIRE(supplies[i] == expect_supplies[i]);
+				REQUIRE(demands[i] == expect_demands[i]);
+			}
+		}
+	}
+}
+
+TEST_CASE("incremental demand kernel matches full recomputation", "[price_computation]")
+{
+	const uint16_t num_assets = 10;
+
+	std::minstd_rand gen(1);
+	std::uniform_real_distribution<double> price_dist(0.5, 2);
+	std::uniform_int_distribution<uint16_t> asset_dist(0, num_assets - 1);
+
+	OrderbookManager manager(num_assets);
+	make_random_orderbooks(manager, num_assets, gen);
+
+	auto& orderbooks = manager.get_orderbooks();
+	const size_t num_orderbooks = orderbooks.size();
+
+	DemandKernel kernel;
+	IncrementalDemandKernel incremental;
+
+	std::vector<Price> prices(num_assets);
+	for (auto& p : prices) {
+		p = price::from_double(price_dist(gen));
+	}
+
+	for (int trial = 0; trial < 200; trial++) {
+		// mostly small changes, occasionally many or none
+		int num_changes = (trial % 17 == 0) ? num_assets : (trial % 3);
+		for (int j = 0; j < num_changes; j++) {
+			prices[asset_dist(gen)] = price::from_double(price_dist(gen));
+		}
+		uint8_t smooth_mult = (trial < 100) ? 5 : 8;
+
+		std::vector<uint128_t> expect_supplies(num_assets, 0), expect_demands(num_assets, 0);
+		SplitAccumulatorVector supplies(num_assets), demands(num_assets);
+
+		kernel.compute(prices.data(), expect_demands.data(), expect_supplies.data(), orderbooks, 1, num_orderbooks, smooth_mult);
+		incremental.compute(prices.data(), demands, supplies, orderbooks, 1, num_orderbooks, num_assets, smooth_mult);
+
+		REQUIRE(!supplies.overflowed());
+		REQUIRE(!demands.overflowed());
+		for (size_t i = 0; i < num_assets; i++) {
+			REQUIRE(supplies.get(i) == expect_supplies[i]);
+			REQUIRE(demands.get(i) == expect_demands[i]);
+		}
+	}
+}
+
+TEST_CASE("incremental demand kernel multi vector queries match full recomputation", "[price_computation]")
+{
+	const uint16_t num_assets = 10;
+	const size_t num_vectors = 4;
+	const uint8_t smooth_mult = 5;
+
+	std::minstd_rand gen(5);
+	std::uniform_real_distribution<double> price_dist(0.5, 2);
+	std::uniform_int_distribution<uint16_t> asset_dist(0, num_assets - 1);
+
+	OrderbookManager manager(num_assets);
+	make_random_orderbooks(manager, num_assets, gen);
+
+	auto& orderbooks = manager.get_orderbooks();
+	const size_t num_orderbooks = orderbooks.size();
+
+	DemandKernel kernel;
+	IncrementalDemandKernel incremental;
+
+	std::vector<Price> prices(num_assets);
+	for (auto& p : prices) {
+		p = price::from_double(price_dist(gen));
+	}
+
+	for (int trial = 0; trial < 50; trial++) {
+		// candidates: a few near the cached prices (patched), and
+		// one far from them (recomputed)
+		std::vector<std::vector<Price>> candidates(num_vectors, prices);
+		for (size_t k = 0; k + 1 < num_vectors; k++) {
+			for (size_t j = 0; j < k; j++) {
+				candidates[k][asset_dist(gen)] = price::from_double(price_dist(gen));
+			}
+		}
+		for (auto& p : candidates.back()) {
+			p = price::from_double(price_dist(gen));
+		}
+
+		std::vector<const Price*> price_ptrs;
+		std::vector<std::vector<uint128_t>> supplies(num_vectors, std::vector<uint128_t>(num_assets, 0));
+		std::vector<std::vector<uint128_t>> demands = supplies;
+		std::vector<uint128_t*> supply_ptrs, demand_ptrs;
+		for (size_t k = 0; k < num_vectors; k++) {
+			price_ptrs.push_back(candidates[k].data());
+			supply_ptrs.push_back(supplies[k].data());
+			demand_ptrs.push_back(demands[k].data());
+		}
+
+		// (the first trial has no cached results)
+		incremental.compute_multi(price_ptrs.data(), num_vectors, demand_ptrs.data(), supply_ptrs.data(), orderbooks, 1, num_orderbooks, num_assets, smooth_mult);
+
+		for (size_t k = 0; k < num_vectors; k++) {
+			std::vector<uint128_t> expect_supplies(num_assets, 0), expect_demands(num_assets, 0);
+			kernel.compute(candidates[k].data(), expect_demands.data(), expect_supplies.data(), orderbooks, 1, num_orderbooks, smooth_mult);
+			REQUIRE(supplies[k] == expect_supplies);
+			REQUIRE(demands[k] == expect_demands);
+		}
+
+		// cached results are unchanged by the multi query
+		std::vector<uint128_t> expect_supplies(num_assets, 0), expect_demands(num_assets, 0);
+		SplitAccumulatorVector single_supplies(num_assets), single_demands(num_assets);
+		kernel.compute(prices.data(), expect_demands.data(), expect_supplies.data(), orderbooks, 1, num_orderbooks, smooth_mult);
+		incremental.compute(prices.data(), single_demands, single_supplies, orderbooks, 1, num_orderbooks, num_assets, smooth_mult);
+		for (size_t i = 0; i < num_assets; i++) {
+			REQUIRE(single_supplies.get(i) == expect_supplies[i]);
+			REQUIRE(single_demands.get(i) == expect_demands[i]);
+		}
+
+		prices[asset_dist(gen)] = price::from_double(price_dist(gen));
+	}
+}
+
+TEST_CASE("multi price vector demand queries", "[price_computation]")
+{
+	const uint16_t num_assets = 10;
+	const size_t num_vectors = 4;
+	const uint8_t smooth_mult = 6;
+
+	std::minstd_rand gen(2);
+	std::uniform_real_distribution<double> price_dist(0.5, 2);
+
+	OrderbookManager manager(num_assets);
+	make_random_orderbooks(manager, num_assets, gen);
+
+	auto& orderbooks = manager.get_orderbooks();
+
+	std::vector<std::vector<Price>> prices(num_vectors, std::vector<Price>(num_assets));
+	std::vector<const Price*> price_ptrs;
+	for (auto& vec : prices) {
+		for (auto& p : vec) {
+			p = price::from_double(price_dist(gen));
+		}
+		price_ptrs.push_back(vec.data());
+	}
+
+	std::vector<std::vector<uint128_t>> supplies(num_vectors, std::vector<uint128_t>(num_assets, 0));
+	std::vector<std::vector<uint128_t>> demands = supplies;
+
+	std::vector<uint128_t*> supply_ptrs, demand_ptrs;
+	for (size_t k = 0; k < num_vectors; k++) {
+		supply_ptrs.push_back(supplies[k].data());
+		demand_ptrs.push_back(demands[k].data());
+	}
+
+	DemandKernel kernel;
+	kernel.compute_multi(price_ptrs.data(), num_vectors, demand_ptrs.data(), supply_ptrs.data(), orderbooks, 0, orderbooks.size(), smooth_mult);
+
+	for (size_t k = 0; k < num_vectors; k++) {
+		std::vector<uint128_t> expect_supplies(num_assets, 0), expect_demands(num_assets, 0);
+		kernel.compute(prices[k].data(), expect_demands.data(), expect_supplies.data(), orderbooks, 0, orderbooks.size(), smooth_mult);
+
+		REQUIRE(supplies[k] == expect_supplies);
+		REQUIRE(demands[k] == expect_demands);
+	}
+}
+
+TEST_CASE("demand oracle multi price vector queries", "[price_computation]")
+{
+	const uint16_t num_assets = 10;
+	const uint8_t smooth_mult = 6;
+
+	std::minstd_rand gen(3);
+	std::uniform_real_distribution<double> price_dist(0.5, 2);
+
+	OrderbookManager manager(num_assets);
+	make_random_orderbooks(manager, num_assets, gen);
+
+	auto& orderbooks = manager.get_orderbooks();
+
+	DemandWorkerPool pool(3);
+	ParallelDemandOracle<5> oracle(orderbooks.size(), num_assets, pool);
+	oracle.activate_oracle(orderbooks);
+
+	DemandKernel kernel;
+
+	auto expect_query = [&] (const Price* prices, std::vector<uint128_t>& supplies, std::vector<uint128_t>& demands) {
+		supplies.assign(num_assets, 0);
+		demands.assign(num_assets, 0);
+		kernel.compute(prices, demands.data(), supplies.data(), orderbooks, 0, orderbooks.size(), smooth_mult);
+	};
+
+	std::vector<Price> single_prices(num_assets);
+	for (auto& p : single_prices) {
+		p = price::from_double(price_dist(gen));
+	}
+
+	// vary the number of vectors, so share workspaces are resized
+	for (size_t num_vectors : {4, 4, 1, 7}) {
+		MultiPriceQueryWorkspace workspace(num_assets, num_vectors);
+
+		for (int trial = 0; trial < 5; trial++) {
+			// odd vectors are close to the single-vector query's
+			// prices, so they reuse its cached results
+			for (size_t k = 0; k < num_vectors; k++) {
+				for (size_t i = 0; i < num_assets; i++) {
+					workspace.get_prices(k)[i] = (k % 2 == 1)
+						? single_prices[i]
+						: price::from_double(price_dist(gen));
+				}
+				if (k % 2 == 1) {
+					workspace.get_prices(k)[k % num_assets] = price::from_double(price_dist(gen));
+				}
+			}
+
+			workspace.query(oracle, orderbooks, smooth_mult);
+
+			for (size_t k = 0; k < num_vectors; k++) {
+				std::vector<uint128_t> expect_supplies, expect_demands;
+				expect_query(workspace.get_prices(k), expect_supplies, expect_demands);
+				for (size_t i = 0; i < num_assets; i++) {
+					REQUIRE(workspace.get_supplies(k)[i] == expect_supplies[i]);
+					REQUIRE(workspace.get_demands(k)[i] == expect_demands[i]);
+				}
+			}
+
+			// single-vector queries (and their cached results) are 
+			// unaffected by multi-vector queries in between
+			std::vector<uint128_t> supplies(num_assets, 0), demands(num_assets, 0);
+			oracle.get_supply_demand(single_prices.data(), supplies.data(), demands.data(), orderbooks, smooth_mult);
+
+			std::vector<uint128_t> expect_supplies, expect_demands;
+			expect_query(single_prices.data(), expect_supplies, expect_demands);
+			REQUIRE(supplies == expect_supplies);
+			REQUIRE(demands == expect_demands);
+
+			single_prices[trial % num_assets] = price::from_double(price_dist(gen));
+		}
+	}
+
+	oracle.deactivate_oracle();
+}
+
+TEST_CASE("demand oracle jacobian diagonal matches serial sum", "[price_computation]")
+{
+	const uint16_t num_assets = 10;
+
+	std::minstd_rand gen(4);
+	std::uniform_real_distribution<double> price_dist(0.5, 2);
+
+	OrderbookManager manager(num_assets);
+	make_random_orderbooks(manager, num_assets, gen);
+
+	auto& orderbooks = manager.get_orderbooks();
+
+	DemandWorkerPool pool(3);
+	ParallelDemandOracle<5> oracle(orderbooks.size(), num_assets, pool);
+	oracle.activate_oracle(orderbooks);
+
+	std::vector<Price> prices(num_assets);
+
+	for (uint8_t smooth_mult : {0, 6}) {
+		for (auto& p : prices) {
+			p = price::from_double(price_dist(gen));
+		}
+
+		std::vector<double> expect(num_assets, 0.0);
+		for (auto const& orderbook : orderbooks) {
+			double sensitivity = orderbook.trade_volume_sensitivity(prices.data(), smooth_mult);
+			expect[orderbook.get_category().sellAsset] += sensitivity;
+			expect[orderbook.get_category().buyAsset] += sensitivity;
+		}
+
+		std::vector<double> diagonal;
+		oracle.get_jacobian_diagonal(prices.data(), orderbooks, smooth_mult, diagonal);
+
+		REQUIRE(diagonal.size() == num_assets);
+		for (size_t i = 0; i < num_assets; i++) {
+			REQUIRE(expect[i] > 0);
+			// shares sum in a different order
+			REQUIRE(std::abs(diagonal[i] - expect[i]) <= 1e-9 * expect[i]);
+		}
+	}
+
+	oracle.deactivate_oracle();
+}
+
+} /* speedex */
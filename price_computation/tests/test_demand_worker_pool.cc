@@ -0,0 +1,138 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "price_computation/demand_worker_pool.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace speedex
+{
+
+namespace {
+
+//! Deterministic per-share work, so results can be checked
+//! against a serial computation.
+uint64_t
+share_result(uint64_t query, size_t share)
+{
+	uint64_t x = query;
+	for (size_t i = 0; i < 256; i++) {
+		x = x * 6364136223846793005ULL + 1442695040888963407ULL + share;
+	}
+	return x;
+}
+
+class TestJob : public DemandPoolJob {
+
+	DemandWorkerPool& pool;
+
+	std::vector<uint64_t> results;
+	std::vector<std::atomic<uint32_t>> runs;
+
+	uint64_t query = 0;
+
+	void run_share(size_t share) override final {
+		runs[share].fetch_add(1, std::memory_order_relaxed);
+		results[share] = share_result(query, share);
+	}
+
+public:
+
+	TestJob(DemandWorkerPool& pool, size_t num_shares, size_t num_nodes)
+		: DemandPoolJob(num_shares)
+		, pool(pool)
+		, results(num_shares)
+		, runs(num_shares)
+	{
+		std::vector<size_t> share_node_bounds;
+		for (size_t n = 0; n <= num_nodes; n++) {
+			share_node_bounds.push_back((num_shares * n) / num_nodes);
+		}
+		set_share_nodes(share_node_bounds.data(), num_nodes);
+		pool.register_job(this);
+	}
+
+	~TestJob() {
+		pool.unregister_job(this);
+	}
+
+	//! Returns false if any share ran other than exactly once,
+	//! or computed the wrong result.
+	bool run_query(uint64_t q) {
+		query = q;
+		for (auto& r : runs) {
+			r.store(0, std::memory_order_relaxed);
+		}
+
+		run_all_shares();
+
+		for (size_t i = 0; i < results.size(); i++) {
+			if (runs[i].load(std::memory_order_relaxed) != 1) {
+				return false;
+			}
+			if (results[i] != share_result(q, i)) {
+				return false;
+			}
+		}
+		return true;
+	}
+};
+
+} /* anonymous namespace */
+
+TEST_CASE("demand worker pool concurrent jobs", "[price_computation]")
+{
+	constexpr size_t NUM_QUERY_THREADS = 6;
+	constexpr size_t JOBS_PER_THREAD = 20;
+	constexpr size_t QUERIES_PER_JOB = 50;
+
+	DemandWorkerPool pool(4);
+
+	std::atomic<size_t> failures = 0;
+	std::vector<std::thread> query_threads;
+
+	for (size_t t = 0; t < NUM_QUERY_THREADS; t++) {
+		query_threads.emplace_back([&, t] {
+			for (size_t j = 0; j < JOBS_PER_THREAD; j++) {
+				// vary share counts and node groupings between jobs
+				const size_t num_shares = 1 + (t + j) % 11;
+				const size_t num_nodes = 1 + (t * j) % std::min<size_t>(num_shares, 3);
+
+				auto job = std::make_unique<TestJob>(pool, num_shares, num_nodes);
+				pool.activate_job();
+				for (size_t q = 0; q < QUERIES_PER_JOB; q++) {
+					if (!job->run_query(t * 1'000'000 + j * 1'000 + q)) {
+						failures.fetch_add(1, std::memory_order_relaxed);
+					}
+				}
+				pool.deactivate_job();
+				// unregisters, and then frees the job while pool
+				// threads may still be scanning other jobs
+				job.reset();
+			}
+		});
+	}
+
+	for (auto& t : query_threads) {
+		t.join();
+	}
+
+	REQUIRE(failures == 0);
+}
+
+TEST_CASE("demand worker pool job registered while inactive", "[price_computation]")
+{
+	DemandWorkerPool pool(2);
+
+	// Registered but never activated: the querying thread runs
+	// every share itself.
+	TestJob job(pool, 5, 1);
+	for (uint64_t q = 0; q < 10; q++) {
+		REQUIRE(job.run_query(q));
+	}
+}
+
+} /* speedex */
@@ -0,0 +1,120 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "price_computation/split_accumulator.h"
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+namespace speedex
+{
+
+using uint128_t = __uint128_t;
+
+TEST_CASE("split accumulator matches uint128 arithmetic", "[price_computation]")
+{
+	const size_t num_assets = 37;
+
+	std::mt19937_64 gen(0);
+
+	auto random_value = [&gen] () -> uint128_t {
+		// (64 + PRICE_BIT_LEN)-bit values, like trade volumes
+		return ((static_cast<uint128_t>(gen() >> 16)) << 64) + gen();
+	};
+
+	std::vector<uint128_t> expect(num_assets, 0);
+	SplitAccumulatorVector acc(num_assets);
+
+	for (int i = 0; i < 10000; i++) {
+		size_t idx = gen() % num_assets;
+		uint128_t value = random_value();
+		if ((gen() % 3 == 0) && expect[idx] >= value) {
+			expect[idx] -= value;
+			acc.sub(idx, value);
+		} else {
+			expect[idx] += value;
+			acc.add(idx, value);
+		}
+	}
+
+	REQUIRE(!acc.overflowed());
+
+	SplitAccumulatorVector sum(num_assets);
+	sum.add(acc);
+	sum.add(acc);
+
+	std::vector<uint128_t> out(num_assets);
+	sum.write_to(out.data());
+
+	for (size_t i = 0; i < num_assets; i++) {
+		REQUIRE(acc.get(i) == expect[i]);
+		REQUIRE(out[i] == expect[i] * 2);
+	}
+	REQUIRE(!sum.overflowed());
+	REQUIRE_NOTHROW(sum.check_overflow());
+}
+
+TEST_CASE("split accumulator overflow detection", "[price_computation]")
+{
+	const uint128_t max = ~static_cast<uint128_t>(0);
+
+	SECTION("single add")
+	{
+		SplitAccumulatorVector acc(1);
+		acc.add(0, max);
+		REQUIRE(!acc.overflowed());
+		acc.add(0, 1);
+		REQUIRE(acc.overflowed());
+		REQUIRE_THROWS(acc.check_overflow());
+
+		acc.clear();
+		REQUIRE(!acc.overflowed());
+	}
+
+	SECTION("sub below zero")
+	{
+		SplitAccumulatorVector acc(1);
+		acc.add(0, static_cast<uint128_t>(1) << 64);
+		acc.sub(0, 1);
+		REQUIRE(!acc.overflowed());
+		REQUIRE(acc.get(0) == (static_cast<uint128_t>(1) << 64) - 1);
+		acc.sub(0, static_cast<uint128_t>(1) << 64);
+		REQUIRE(acc.overflowed());
+	}
+
+	SECTION("lane-wise add")
+	{
+		SplitAccumulatorVector a(2), b(2);
+		a.add(0, max - 5);
+		b.add(0, 5);
+		a.add(1, max);
+		b.add(1, 0);
+
+		SplitAccumulatorVector c(2);
+		c.add(a);
+		c.add(b);
+		REQUIRE(!c.overflowed());
+		REQUIRE(c.get(0) == max);
+		REQUIRE(c.get(1) == max);
+
+		SplitAccumulatorVector d(2);
+		d.add(0, 6);
+		c.add(d);
+		REQUIRE(c.overflowed());
+	}
+
+	SECTION("carry into saturated high lane")
+	{
+		SplitAccumulatorVector a(1), b(1);
+		a.add(0, (max >> 64) << 64);
+		b.add(0, static_cast<uint64_t>(max));
+		a.add(b);
+		REQUIRE(!a.overflowed());
+		SplitAccumulatorVector one(1);
+		one.add(0, 1);
+		a.add(one);
+		REQUIRE(a.overflowed());
+	}
+}
+
+} /* speedex */
@@ -36,6 +36,11 @@ log_static_configs()
 	std::printf("MAX_SEQ_NUMS_PER_BLOCK         = %lu\n", MAX_SEQ_NUMS_PER_BLOCK);
 	std::printf("LOG_TRANSFERS                  = %u\n", LOG_TRANSFERS);
 	std::printf("NUM_ACCOUNT_DB_SHARDS          = %u\n", NUM_ACCOUNT_DB_SHARDS);
+	std::printf("NUM_ORDERBOOK_DB_SHARDS        = %u\n", NUM_ORDERBOOK_DB_SHARDS);
+	std::printf("NUM_LP_CHECK_THREADS           = %u\n", NUM_LP_CHECK_THREADS);
+	std::printf("NUM_DEMAND_POOL_THREADS        = %u\n", NUM_DEMAND_POOL_THREADS);
+	std::printf("DEMAND_POOL_FIRST_CORE         = %d\n", DEMAND_POOL_FIRST_CORE);
+	std::printf("NUMA_AWARE_PLACEMENT           = %u\n", NUMA_AWARE_PLACEMENT);
 	std::printf("====================================\n");
 }
 
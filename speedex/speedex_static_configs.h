@@ -70,6 +70,45 @@ constexpr static bool PREALLOC_BLOCK_FILES = true;
 	constexpr static uint32_t NUM_ACCOUNT_DB_SHARDS = _NUM_ACCOUNT_DB_SHARDS;
 #endif
 
+//! Orderbook lmdb environments, each persisted by its own thread.
+#ifndef _NUM_ORDERBOOK_DB_SHARDS
+	constexpr static uint32_t NUM_ORDERBOOK_DB_SHARDS = 4;
+#else
+	constexpr static uint32_t NUM_ORDERBOOK_DB_SHARDS = _NUM_ORDERBOOK_DB_SHARDS;
+#endif
+
+//! Threads running Tatonnement's LP feasibility checks.
+#ifndef _NUM_LP_CHECK_THREADS
+	constexpr static uint32_t NUM_LP_CHECK_THREADS = 2;
+#else
+	constexpr static uint32_t NUM_LP_CHECK_THREADS = _NUM_LP_CHECK_THREADS;
+#endif
+
+//! Threads computing supply/demand for Tatonnement,
+//! shared by all concurrent Tatonnement queries.
+#ifndef _NUM_DEMAND_POOL_THREADS
+	constexpr static uint32_t NUM_DEMAND_POOL_THREADS = 8;
+#else
+	constexpr static uint32_t NUM_DEMAND_POOL_THREADS = _NUM_DEMAND_POOL_THREADS;
+#endif
+
+//! If nonnegative, demand pool thread i is pinned to core
+//! DEMAND_POOL_FIRST_CORE + i.
+#ifndef _DEMAND_POOL_FIRST_CORE
+	constexpr static int32_t DEMAND_POOL_FIRST_CORE = -1;
+#else
+	constexpr static int32_t DEMAND_POOL_FIRST_CORE = _DEMAND_POOL_FIRST_CORE;
+#endif
+
+//! Build each orderbook's index on (and pin demand pool threads to)
+//! the NUMA node whose threads evaluate it in Tatonnement.
+//! Overrides DEMAND_POOL_FIRST_CORE.
+#ifdef _NUMA_AWARE_PLACEMENT
+	constexpr static bool NUMA_AWARE_PLACEMENT = true;
+#else
+	constexpr static bool NUMA_AWARE_PLACEMENT = false;
+#endif
+
 #if 0
 // setup for blockstm replication
 constexpr static uint32_t MAX_SEQ_NUMS_PER_BLOCK = 16'000;
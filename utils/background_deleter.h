@@ -18,6 +18,8 @@
 
 #pragma once
 
+#include <cstddef>
+#include <deque>
 #include <memory>
 #include <vector>
 
@@ -28,67 +30,115 @@ namespace speedex {
 /*! Background task that deletes batches of pointers.
 
 Mainly used for deleting complex data structures, like tries.
+Callers hand over whole structures (e.g. the root of a cleared trie),
+so handing off a batch is O(batch size), regardless of how much
+memory the worker then frees.
+
+New batches are queued while the worker deletes earlier ones,
+outside of the lock.  At most max_queued_batches batches wait in the
+queue; beyond that, call_delete() blocks until the worker catches
+up, so that memory is not held indefinitely when batches arrive
+faster than they can be freed.
 */
 template<typename ToBeDeleted>
 class BackgroundDeleter : public utils::AsyncWorker {
 
-	std::vector<ToBeDeleted*> work;
+	//! Batches waiting to be deleted, oldest first.
+	std::deque<std::vector<ToBeDeleted*>> work;
+	//! Worker is deleting a batch (taken out of work).
+	bool deleting = false;
+
+	//! High-water mark for work.size().
+	const size_t max_queued_batches;
 
 	bool exists_work_to_do() override final {
-		return work.size() != 0;
+		return work.size() != 0 || deleting;
 	}
 
 	//! Delete a batch of pointers.
-	void do_deletions() {
-		for (ToBeDeleted* ptr : work) {
+	static void do_deletions(std::vector<ToBeDeleted*>& batch) {
+		for (ToBeDeleted* ptr : batch) {
 			delete ptr;
 		}
-		work.clear();
+		batch.clear();
 	}
 
 	void run() {
+		std::vector<ToBeDeleted*> batch;
 		while(true) {
-			std::unique_lock lock(mtx);
-
-			if ((!done_flag) && (!exists_work_to_do())) {
-				cv.wait(
-					lock, 
-					[this] () {
-						return done_flag || exists_work_to_do();
-					});
+			{
+				std::unique_lock lock(mtx);
+
+				if ((!done_flag) && (work.size() == 0)) {
+					cv.wait(
+						lock, 
+						[this] () {
+							return done_flag || work.size() != 0;
+						});
+				}
+
+				if (done_flag) break;
+				batch = std::move(work.front());
+				work.pop_front();
+				deleting = true;
+				// call_delete() may be waiting for room in the queue
+				cv.notify_all();
 			}
 
-			if (done_flag) break;
-			do_deletions();
+			do_deletions(batch);
+
+			std::lock_guard lock(mtx);
+			deleting = false;
 			cv.notify_all();
 		}
 	}
 
+	//! Queue a batch, first waiting for room in the queue.
+	void enqueue(std::vector<ToBeDeleted*>&& batch) {
+		std::unique_lock lock(mtx);
+		cv.wait(
+			lock,
+			[this] () {
+				return done_flag || work.size() < max_queued_batches;
+			});
+		work.push_back(std::move(batch));
+		cv.notify_all();
+	}
+
 public:
 
-	BackgroundDeleter()
-		: AsyncWorker() {
+	constexpr static size_t DEFAULT_MAX_QUEUED_BATCHES = 4;
+
+	BackgroundDeleter(size_t max_queued_batches = DEFAULT_MAX_QUEUED_BATCHES)
+		: AsyncWorker()
+		, max_queued_batches(max_queued_batches > 0 ? max_queued_batches : 1) {
 			start_async_thread([this] {run();});
 		}
 
 	~BackgroundDeleter() {
 		terminate_worker();
+		for (auto& batch : work) {
+			do_deletions(batch);
+		}
 	}
 	
 	//! Delete a single pointer
 	void call_delete(ToBeDeleted* ptr) {
-		wait_for_async_task();
-		std::lock_guard lock(mtx);
-		work.push_back(ptr);
-		cv.notify_all();
+		enqueue(std::vector<ToBeDeleted*>{ptr});
 	}
 
 	//! Delete a batch of pointers
 	void call_delete(std::vector<ToBeDeleted*> ptrs) {
-		wait_for_async_task();
+		if (ptrs.size() > 0) {
+			enqueue(std::move(ptrs));
+		}
+	}
+
+	//! Number of batches waiting to be deleted
+	//! (not counting a batch being deleted).
+	size_t num_queued_batches() {
 		std::lock_guard lock(mtx);
-		work = ptrs;
-		cv.notify_all();
+		return work.size();
 	}
 };
 
@@ -91,11 +91,23 @@ clear_memory_database_lmdb_dir() {
 std::string orderbook_lmdb_dir() {
 	return std::string(ROOT_DB_DIRECTORY) + std::string(OFFER_DB);
 }
+
+std::string orderbook_lmdb_shard_dir(uint32_t shard)
+{
+	return orderbook_lmdb_dir() + std::to_string(shard) + "/";
+}
+
 void
 make_orderbook_lmdb_dir() {
 	mkdir_safe(ROOT_DB_DIRECTORY);
 	auto path = orderbook_lmdb_dir();
 	mkdir_safe(path.c_str());
+
+	for (uint32_t shard = 0; shard < NUM_ORDERBOOK_DB_SHARDS; shard++)
+	{
+		path = orderbook_lmdb_shard_dir(shard);
+		mkdir_safe(path.c_str());
+	}
 }
 
 void
@@ -0,0 +1,74 @@
+/**
+ * SPEEDEX: A Scalable, Parallelizable, and Economically Efficient Decentralized Exchange
+ * Copyright (C) 2023 Geoffrey Ramseyer
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "utils/numa_task_arenas.h"
+
+#include "utils/numa_topology.h"
+
+#include <pthread.h>
+
+namespace speedex {
+
+namespace {
+
+//! Affinity of the calling thread before it entered an arena.
+thread_local cpu_set_t saved_affinity;
+thread_local bool has_saved_affinity = false;
+
+} /* anonymous namespace */
+
+NumaTaskArenas::PinningObserver::PinningObserver(tbb::task_arena& arena, size_t node)
+	: tbb::task_scheduler_observer(arena)
+	, node(node)
+{
+	arena.initialize();
+	observe(true);
+}
+
+NumaTaskArenas::PinningObserver::~PinningObserver()
+{
+	observe(false);
+}
+
+void
+NumaTaskArenas::PinningObserver::on_scheduler_entry(bool)
+{
+	has_saved_affinity = 
+		(pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &saved_affinity) == 0);
+	NumaTopology::get().pin_current_thread(node);
+}
+
+void
+NumaTaskArenas::PinningObserver::on_scheduler_exit(bool)
+{
+	if (has_saved_affinity) {
+		pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &saved_affinity);
+		has_saved_affinity = false;
+	}
+}
+
+NumaTaskArenas::NumaTaskArenas()
+{
+	auto const& topology = NumaTopology::get();
+	for (size_t node = 0; node < topology.num_nodes(); node++) {
+		node_arenas.push_back(std::make_unique<NodeArena>(
+			node, static_cast<int>(topology.get_node_cpus(node).size())));
+	}
+}
+
+} /* speedex */
@@ -0,0 +1,116 @@
+/**
+ * SPEEDEX: A Scalable, Parallelizable, and Economically Efficient Decentralized Exchange
+ * Copyright (C) 2023 Geoffrey Ramseyer
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/*! \file numa_task_arenas.h
+
+One tbb task arena per NUMA node.  A thread running work in a
+node's arena (including any nested tbb work, which stays in the
+arena) is pinned to the node's cpus, so memory first touched by that
+work is allocated on the node.
+
+Arenas are persistent; threads are not created per use.
+*/
+
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <vector>
+
+#include <sched.h>
+
+#include <tbb/task_arena.h>
+#include <tbb/task_group.h>
+#include <tbb/task_scheduler_observer.h>
+
+#include <utils/non_movable.h>
+
+namespace speedex {
+
+class NumaTaskArenas : private utils::NonMovableOrCopyable {
+
+	//! Pins threads to a node while they are in the node's arena,
+	//! and restores their previous affinity when they leave.
+	class PinningObserver : public tbb::task_scheduler_observer {
+		const size_t node;
+
+	public:
+		PinningObserver(tbb::task_arena& arena, size_t node);
+		~PinningObserver();
+
+		void on_scheduler_entry(bool is_worker) override final;
+		void on_scheduler_exit(bool is_worker) override final;
+	};
+
+	struct NodeArena {
+		tbb::task_arena arena;
+		PinningObserver observer;
+		tbb::task_group group;
+
+		NodeArena(size_t node, int concurrency)
+			: arena(concurrency, 0)
+			, observer(arena, node)
+			, group() {}
+	};
+
+	std::vector<std::unique_ptr<NodeArena>> node_arenas;
+
+public:
+
+	//! One arena per node of NumaTopology::get(), each with
+	//! as many slots as the node has cpus.
+	NumaTaskArenas();
+
+	size_t num_nodes() const {
+		return node_arenas.size();
+	}
+
+	//! Run fn(node) in every node's arena, concurrently,
+	//! and wait for all of them.  Rethrows the first exception
+	//! thrown (after every node's work finishes).
+	template<typename Fn>
+	void run_on_each_node(Fn&& fn) {
+		for (size_t node = 0; node < node_arenas.size(); node++) {
+			auto& node_arena = *node_arenas[node];
+			node_arena.arena.execute([&node_arena, &fn, node] {
+				node_arena.group.run([&fn, node] {
+					fn(node);
+				});
+			});
+		}
+
+		std::exception_ptr error;
+		for (auto& node_arena : node_arenas) {
+			try {
+				node_arena->arena.execute([&node_arena] {
+					node_arena->group.wait();
+				});
+			} catch (...) {
+				if (!error) {
+					error = std::current_exception();
+				}
+			}
+		}
+		if (error) {
+			std::rethrow_exception(error);
+		}
+	}
+};
+
+} /* speedex */
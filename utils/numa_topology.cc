@@ -0,0 +1,128 @@
+/**
+ * SPEEDEX: A Scalable, Parallelizable, and Economically Efficient Decentralized Exchange
+ * Copyright (C) 2023 Geoffrey Ramseyer
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "utils/numa_topology.h"
+
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+namespace speedex {
+
+std::vector<int>
+NumaTopology::parse_cpulist(const std::string& cpulist)
+{
+	std::vector<int> out;
+	std::stringstream ss(cpulist);
+	std::string range;
+	while (std::getline(ss, range, ',')) {
+		if (range.empty() || range == "\n") {
+			continue;
+		}
+		auto dash = range.find('-');
+		int lo = std::stoi(range.substr(0, dash));
+		int hi = (dash == std::string::npos) ? lo : std::stoi(range.substr(dash + 1));
+		for (int cpu = lo; cpu <= hi; cpu++) {
+			out.push_back(cpu);
+		}
+	}
+	return out;
+}
+
+NumaTopology::NumaTopology()
+{
+	// node ids need not be contiguous, but in practice they are
+	// (on Linux, up to CONFIG_NODES_SHIFT).
+	constexpr static int MAX_NODE_ID = 1024;
+	for (int node = 0; node < MAX_NODE_ID; node++) {
+		std::ifstream f("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+		if (!f) {
+			continue;
+		}
+		std::string cpulist;
+		std::getline(f, cpulist);
+		auto cpus = parse_cpulist(cpulist);
+		if (!cpus.empty()) {
+			node_cpus.push_back(std::move(cpus));
+		}
+	}
+
+	if (node_cpus.empty()) {
+		node_cpus.emplace_back();
+		for (int cpu = 0; cpu < static_cast<int>(std::thread::hardware_concurrency()); cpu++) {
+			node_cpus.back().push_back(cpu);
+		}
+	}
+}
+
+const NumaTopology&
+NumaTopology::get()
+{
+	static NumaTopology topology;
+	return topology;
+}
+
+bool
+NumaTopology::pin_current_thread(size_t node) const
+{
+	cpu_set_t cpuset;
+	CPU_ZERO(&cpuset);
+	for (int cpu : get_node_cpus(node)) {
+		if (cpu < CPU_SETSIZE) {
+			CPU_SET(cpu, &cpuset);
+		}
+	}
+	return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset) == 0;
+}
+
+bool
+NumaTopology::interleave_current_thread_memory()
+{
+	std::ifstream f("/sys/devices/system/node/has_memory");
+	if (!f) {
+		return false;
+	}
+	std::string nodelist;
+	std::getline(f, nodelist);
+
+	constexpr static size_t BITS_PER_WORD = 8 * sizeof(unsigned long);
+
+	// node ids, unlike node indices, include memory-only nodes
+	std::vector<unsigned long> mask;
+	for (int node : parse_cpulist(nodelist)) {
+		size_t word = node / BITS_PER_WORD;
+		if (mask.size() <= word) {
+			mask.resize(word + 1, 0);
+		}
+		mask[word] |= 1ul << (node % BITS_PER_WORD);
+	}
+	if (mask.empty()) {
+		return false;
+	}
+
+	// glibc has no wrapper (libnuma's numaif.h does)
+	return syscall(SYS_set_mempolicy, MPOL_INTERLEAVE, mask.data(), mask.size() * BITS_PER_WORD + 1) == 0;
+}
+
+} /* speedex */
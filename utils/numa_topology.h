@@ -0,0 +1,73 @@
+/**
+ * SPEEDEX: A Scalable, Parallelizable, and Economically Efficient Decentralized Exchange
+ * Copyright (C) 2023 Geoffrey Ramseyer
+
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/*! \file numa_topology.h
+
+NUMA nodes of the machine, and the cpus of each node,
+as reported by /sys/devices/system/node.
+
+Machines without that directory (or with only one node)
+look like a single node containing every cpu.
+Nodes without cpus (memory-only nodes) are skipped.
+*/
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace speedex {
+
+class NumaTopology {
+
+	//! cpus of each node, in increasing order.
+	std::vector<std::vector<int>> node_cpus;
+
+	NumaTopology();
+
+public:
+
+	//! Parse a sysfs cpulist (e.g. "0-3,8,10-11").
+	static std::vector<int> parse_cpulist(const std::string& cpulist);
+
+	//! Topology of this machine (read once).
+	static const NumaTopology& get();
+
+	size_t num_nodes() const {
+		return node_cpus.size();
+	}
+
+	const std::vector<int>& get_node_cpus(size_t node) const {
+		return node_cpus.at(node);
+	}
+
+	//! Restrict the calling thread to the cpus of \a node.
+	//! Memory the thread touches first is then (by the default
+	//! first-touch policy) allocated on \a node.
+	//! Returns false if the affinity could not be set.
+	bool pin_current_thread(size_t node) const;
+
+	//! Interleave pages allocated by the calling thread across
+	//! every node with memory (like numactl --interleave=all).
+	//! Threads that it creates afterwards inherit the policy.
+	//! Returns false if the policy could not be set.
+	static bool interleave_current_thread_memory();
+};
+
+} /* speedex */
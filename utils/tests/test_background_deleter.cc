@@ -0,0 +1,133 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "utils/background_deleter.h"
+
+#include <malloc.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+namespace speedex {
+
+namespace {
+
+//! Heap-allocated garbage that tracks how many instances are alive.
+struct TrackedGarbage {
+	static std::atomic<size_t> num_live;
+
+	std::vector<char> payload;
+
+	TrackedGarbage(size_t payload_size)
+		: payload(payload_size, 1) {
+		num_live++;
+	}
+
+	~TrackedGarbage() {
+		num_live--;
+	}
+};
+
+std::atomic<size_t> TrackedGarbage::num_live = 0;
+
+//! Garbage that takes a while to free.
+struct SlowGarbage {
+	static std::atomic<size_t> num_live;
+
+	SlowGarbage() {
+		num_live++;
+	}
+
+	~SlowGarbage() {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		num_live--;
+	}
+};
+
+std::atomic<size_t> SlowGarbage::num_live = 0;
+
+//! Sanitizers replace malloc, so mallinfo2() tells us nothing there.
+#if defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__)
+constexpr bool CHECK_HEAP_USAGE = false;
+#else
+constexpr bool CHECK_HEAP_USAGE = true;
+#endif
+
+size_t
+heap_bytes_in_use() {
+	return mallinfo2().uordblks;
+}
+
+} /* anonymous namespace */
+
+TEST_CASE("background deleter reclaims memory", "[utils]")
+{
+	constexpr size_t NUM_BATCHES = 16;
+	constexpr size_t BATCH_SIZE = 256;
+	constexpr size_t PAYLOAD_SIZE = 16 * 1024;
+	constexpr size_t TOTAL_BYTES = NUM_BATCHES * BATCH_SIZE * PAYLOAD_SIZE;
+
+	BackgroundDeleter<TrackedGarbage> deleter;
+
+	size_t baseline = heap_bytes_in_use();
+
+	std::vector<std::vector<TrackedGarbage*>> batches(NUM_BATCHES);
+	for (auto& batch : batches) {
+		for (size_t i = 0; i < BATCH_SIZE; i++) {
+			batch.push_back(new TrackedGarbage(PAYLOAD_SIZE));
+		}
+	}
+
+	REQUIRE(TrackedGarbage::num_live == NUM_BATCHES * BATCH_SIZE);
+	if (CHECK_HEAP_USAGE) {
+		REQUIRE(heap_bytes_in_use() >= baseline + TOTAL_BYTES);
+	}
+
+	for (auto& batch : batches) {
+		deleter.call_delete(std::move(batch));
+	}
+	deleter.wait_for_async_task();
+
+	REQUIRE(TrackedGarbage::num_live == 0);
+	if (CHECK_HEAP_USAGE) {
+		// back to (about) where it started, i.e. returned to the allocator
+		REQUIRE(heap_bytes_in_use() < baseline + TOTAL_BYTES / 100);
+	}
+}
+
+TEST_CASE("background deleter bounds its queue", "[utils]")
+{
+	constexpr size_t MAX_QUEUED = 2;
+
+	BackgroundDeleter<SlowGarbage> deleter(MAX_QUEUED);
+
+	// Batches arrive faster than they are freed, so call_delete()
+	// has to wait for room in the queue.
+	for (int i = 0; i < 20; i++) {
+		std::vector<SlowGarbage*> batch;
+		for (int j = 0; j < 5; j++) {
+			batch.push_back(new SlowGarbage());
+		}
+		deleter.call_delete(std::move(batch));
+		REQUIRE(deleter.num_queued_batches() <= MAX_QUEUED);
+	}
+
+	deleter.wait_for_async_task();
+	REQUIRE(deleter.num_queued_batches() == 0);
+	REQUIRE(SlowGarbage::num_live == 0);
+}
+
+TEST_CASE("background deleter frees queued batches on destruction", "[utils]")
+{
+	{
+		BackgroundDeleter<SlowGarbage> deleter(8);
+		for (int i = 0; i < 8; i++) {
+			deleter.call_delete(new SlowGarbage());
+		}
+	}
+	REQUIRE(SlowGarbage::num_live == 0);
+}
+
+} /* speedex */
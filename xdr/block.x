@@ -85,6 +85,14 @@ struct BlockHeaderHashValue {
 	uint32 validation_success;
 };
 
+struct TatonnementConfigurationStats {
+	uint32 step_radix;
+	uint32 use_volume_relativizer; // 1 if yes, 0 if no
+	uint32 use_jacobian_preconditioner; // 1 if yes, 0 if no
+	uint32 num_threads;
+	uint32 window_wins;
+};
+
 struct TatonnementMeasurements {
 	float runtime;
 	uint32 step_radix;
@@ -93,6 +101,13 @@ struct TatonnementMeasurements {
 	uint32 achieved_smooth_mult;
 };
 
+// Kept out of TatonnementMeasurements, whose encoding is fixed
+// by recorded experiment results (see experiments.x).
+struct TatonnementPortfolioStats {
+	int32 winning_configuration; // index into configuration_stats, -1 if none
+	TatonnementConfigurationStats configuration_stats<>;
+};
+
 struct BlockStateUpdateStats {
 	uint32 new_offer_count;
 	uint32 cancel_offer_count;